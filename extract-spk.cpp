@@ -8,10 +8,32 @@
 #include <assert.h>
 #include <limits.h>
 #include <inttypes.h>
+#include <fnmatch.h>
+#include <getopt.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <chrono>
 
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
 
 #include "spk.h"
+#include "pool.h"
+#include "schedule.h"
+#include "hash.h"
+#include "sparse.h"
+#include "tar.h"
+#ifdef HAVE_ZLIB
+#include "targz.h"
+#endif
 
 static void mkdir_p(const char *dir) {
   char tmp[PATH_MAX];
@@ -50,55 +72,601 @@ void dumpFile(FILE* f, off_t strs, off_t sdat, size_t length, mode_t permissions
 }
 #endif
 
-static void extractFile(char* path, File* file) {
+static std::string prepareOutput(const char* path, File* file) {
   //FIXME
   printf("Visiting '%s%s'\n", path, file->name);
 
   char out_path_buffer[PATH_MAX];
   sprintf(out_path_buffer, "%s%s", path, file->name);
   mkdir_p(out_path_buffer);
-  FILE* out = fopen(out_path_buffer, "wb");
-  size_t chunk_size = 2 * 1024 * 1024;
-  uint8_t* chunk = (uint8_t*)malloc(chunk_size);
-  size_t size = file->size;
+  return out_path_buffer;
+}
+
+static FILE* openOutput(const char* path, File* file) {
+  std::string out_path = prepareOutput(path, file);
+  FILE* out = fopen(out_path.c_str(), "wb");
+  if (out == NULL) {
+    printf("Unable to open '%s'\n", out_path.c_str());
+  }
+  return out;
+}
+
+// Selection of what to extract; empty lists select everything
+static std::vector<const char*> includes;
+static std::vector<const char*> excludes;
+static std::vector<const char*> packages;
+static bool browse_header = false;
+static bool sparse = false;
+
+struct Entry {
+  std::string path; // Folder relative to the output root, with trailing slash
+  File* file;
+};
+
+static bool matchesAny(const std::vector<const char*>& patterns, const char* s) {
+  for(const char* pattern : patterns) {
+    if (fnmatch(pattern, s, 0) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool isPackageSelected(const char* foldername) {
+  if (packages.empty()) {
+    return true;
+  }
+
+  // Package folders are named "<name>-<version>", so allow selecting either
+  std::string name = foldername;
+  size_t dash = name.rfind('-');
+  if (dash != std::string::npos) {
+    name.resize(dash);
+  }
+  return matchesAny(packages, foldername) || matchesAny(packages, name.c_str());
+}
+
+static bool isFileSelected(const std::string& path) {
+  if (!includes.empty() && !matchesAny(includes, path.c_str())) {
+    return false;
+  }
+  return !matchesAny(excludes, path.c_str());
+}
+
+// Only looks at the index, so no SDAT is touched for files which are filtered
+static void collectFolder(const std::string& path, Folder* folder, std::vector<Entry>& entries) {
+  std::string subpath = path + folder->name + "/";
+  for(unsigned int i = 0; i < folder->folder_count; i++) {
+    collectFolder(subpath, folder->folders[i], entries);
+  }
+  for(unsigned int i = 0; i < folder->file_count; i++) {
+    File* file = folder->files[i];
+    if (isFileSelected(subpath + file->name)) {
+      entries.push_back({ subpath, file });
+    }
+  }
+}
+
+static void collectRootFolder(Folder* root_folder, std::vector<Entry>& entries) {
+  for(unsigned int i = 0; i < root_folder->folder_count; i++) {
+    Folder* package_folder = root_folder->folders[i];
+    if (isPackageSelected(package_folder->name)) {
+      collectFolder("", package_folder, entries);
+    }
+  }
+
+  // Files at the root are not part of any package
+  if (packages.empty()) {
+    for(unsigned int i = 0; i < root_folder->file_count; i++) {
+      File* file = root_folder->files[i];
+      if (isFileSelected(file->name)) {
+        entries.push_back({ "", file });
+      }
+    }
+  }
+}
+
+static bool readArchive(FILE* f, void* data, off_t offset, size_t length) {
+  return spk_pread(fileno(f), data, length, offset);
+}
+
+// Data arrives in archive order, so only files which share a chunk are open at once.
+// root is the output folder, with trailing slash. Returns false if the archive couldn't be read.
+static bool extractEntries(FILE* f, const std::vector<Entry>& entries, const std::string& root) {
+  std::vector<File*> files;
+  for(const Entry& entry : entries) {
+    files.push_back(entry.file);
+  }
+  std::vector<FILE*> outputs(entries.size(), NULL);
+
+  bool ok = scheduleReads(files.data(), files.size(),
+    [=](void* data, off_t offset, size_t length) {
+      return readArchive(f, data, offset, length);
+    },
+    [&](unsigned int index, const void* data, off_t offset, size_t length) {
+      File* file = files[index];
+      if (offset == 0) {
+        outputs[index] = openOutput((root + entries[index].path).c_str(), file);
+      }
+      if (outputs[index] == NULL) {
+        return;
+      }
+      IoSlot slot;
+      FILE* out = outputs[index];
+      if (sparse) {
+        // Zero blocks are skipped, so they become holes
+        sparse_split(data, offset, length, [&](const void* run, off_t run_offset, size_t run_length) {
+          fseeko(out, run_offset, SEEK_SET);
+          fwrite(run, 1, run_length, out);
+        });
+      } else {
+        fwrite(data, 1, length, out);
+      }
+      if (offset + length == file->size) {
+        if (sparse) {
+          fflush(out);
+          ftruncate(fileno(out), file->size);
+        }
+        fclose(outputs[index]);
+        outputs[index] = NULL;
+      }
+    }
+  );
+
+  // After a failed read, files which didn't get all their data are still open
+  for(FILE* out : outputs) {
+    if (out != NULL) {
+      fclose(out);
+    }
+  }
+
+  return ok;
+}
+
+// Offset of the HMAC key in the factory key file (same as pack-spk.py)
+#define FACTORY_KEY_OFFSET 0xB0
+#define FACTORY_KEY_SIZE 16
+
+#ifdef HAVE_IO_URING
+static bool use_io_uring = false;
+static unsigned int queue_depth = IORING_DEFAULT_QUEUE_DEPTH;
+#endif
+
+static bool verify = false;
+static const char* batch_path = NULL;
+static const char* key_path = NULL;
+static uint8_t key[FACTORY_KEY_SIZE];
+
+static bool readFactoryKey(const char* path, uint8_t key[FACTORY_KEY_SIZE]) {
+  FILE* f = fopen(path, "rb");
+  if (f == NULL) {
+    printf("Unable to open '%s'\n", path);
+    return false;
+  }
+  fseek(f, FACTORY_KEY_OFFSET, SEEK_SET);
+  bool ok = (fread(key, 1, FACTORY_KEY_SIZE, f) == FACTORY_KEY_SIZE);
+  if (!ok) {
+    printf("Factory key '%s' is too short\n", path);
+  }
+  fclose(f);
+  return ok;
+}
+
+// Checks data against the checksums of the index, returns the number of mismatches
+// (files which couldn't be read completely count as mismatches, too).
+// Files in the same chunk are hashed side by side; they are finished once the chunk is done.
+static unsigned int verifyEntries(FILE* f, const std::vector<Entry>& entries, const uint8_t* key) {
+  std::vector<File*> files;
+  for(const Entry& entry : entries) {
+    files.push_back(entry.file);
+  }
+  std::vector<HashState> states(entries.size());
+  std::vector<unsigned int> finished;
+  unsigned int failures = 0;
+  size_t checked = 0;
+  bool read_failed = false;
+
+  Hasher* hasher = hasher_create(key, FACTORY_KEY_SIZE);
+  printf("Verifying %zu files (%u lanes)\n", entries.size(), hasher_lanes(hasher));
+
+  auto checkFinished = [&]() {
+    hasher_flush(hasher);
+    for(unsigned int index : finished) {
+      const SpkFile* spk_file = files[index]->spk_file;
+      uint8_t md5[16];
+      uint8_t hmac[20];
+      hasher_final(hasher, &states[index], md5, hmac);
+      bool ok = !memcmp(md5, spk_file->checksum2, sizeof(md5));
+      if (key != NULL && memcmp(hmac, spk_file->checksum, sizeof(hmac))) {
+        ok = false;
+      }
+      if (!ok) {
+        printf("Checksum mismatch for '%s%s'\n", entries[index].path.c_str(), files[index]->name);
+        failures++;
+      }
+      checked++;
+    }
+    finished.clear();
+  };
+
+  auto hashData = [&](unsigned int index, const void* data, off_t offset, size_t length) {
+    if (offset == 0) {
+      hasher_begin(hasher, &states[index]);
+    }
+    hasher_update(hasher, &states[index], data, length);
+    if (offset + length == files[index]->size) {
+      finished.push_back(index);
+    }
+  };
+
+#ifdef HAVE_IO_URING
+  IoRing* ring = use_io_uring ? ioring_create(queue_depth) : NULL;
+  if (ring != NULL) {
+    if (!scheduleReadsAsync(files.data(), files.size(), ring, fileno(f), hashData, checkFinished)) {
+      read_failed = true;
+    }
+    ioring_free(ring);
+  } else
+#endif
+  if (!scheduleReads(files.data(), files.size(),
+        [=](void* data, off_t offset, size_t length) {
+          return readArchive(f, data, offset, length);
+        },
+        hashData,
+        checkFinished)) {
+    read_failed = true;
+  }
+
+  // Empty files don't belong to any chunk
+  checkFinished();
+
+  // Files which didn't get all their data can't be checked
+  if (read_failed) {
+    failures += entries.size() - checked;
+  }
+
+  hasher_free(hasher);
+  return failures;
+}
+
+// Duplicates are reflinked; if the file system can't do that, this is used instead
+enum DedupFallback {
+  DEDUP_OFF,
+  DEDUP_COPY,
+  DEDUP_HARDLINK
+};
+
+static DedupFallback dedup = DEDUP_OFF;
+
+struct Duplicate {
+  size_t entry;
+  size_t original; // Entry which has the same content and is extracted
+};
+
+// Uses MD5 and size from the index, so no data has to be read to find duplicates.
+// Returns the entries which have to be extracted.
+static std::vector<Entry> findDuplicates(const std::vector<Entry>& entries, std::vector<Duplicate>& duplicates) {
+  std::vector<Entry> unique;
+  std::map<std::string, size_t> seen;
+  for(size_t i = 0; i < entries.size(); i++) {
+    const File* file = entries[i].file;
+    if (file->spk_file == NULL || file->size == 0) {
+      unique.push_back(entries[i]);
+      continue;
+    }
+
+    std::string key((const char*)file->spk_file->checksum2, sizeof(file->spk_file->checksum2));
+    key.append((const char*)&file->size, sizeof(file->size));
+    auto it = seen.find(key);
+    if (it != seen.end()) {
+      duplicates.push_back({ i, it->second });
+      continue;
+    }
+    seen[key] = i;
+    unique.push_back(entries[i]);
+  }
+  return unique;
+}
+
+static bool copyFile(int in, int out) {
+  static const size_t buffer_size = 1024 * 1024;
+  std::vector<uint8_t> buffer(buffer_size);
   off_t offset = 0;
-  while (size > 0) {   
-    if (size < chunk_size) {
-      chunk_size = size;
+  while(true) {
+    ssize_t length = read(in, buffer.data(), buffer_size);
+    if (length < 0) {
+      return false;
     }
-    file->read(chunk, offset, chunk_size);
-    fwrite(chunk, 1, chunk_size, out);
-    size -= chunk_size;
-    offset += chunk_size;
+    if (length == 0) {
+      return !sparse || (ftruncate(out, offset) == 0);
+    }
+    IoSlot slot;
+    bool ok = true;
+    if (sparse) {
+      sparse_split(buffer.data(), offset, length, [&](const void* run, off_t run_offset, size_t run_length) {
+        ok &= (pwrite(out, run, run_length, run_offset) == (ssize_t)run_length);
+      });
+    } else {
+      ok = (write(out, buffer.data(), length) == length);
+    }
+    if (!ok) {
+      return false;
+    }
+    offset += length;
   }
-  free(chunk);
-  fclose(out);
 }
 
-static void extractFolder(const char* path, Folder* folder) {
-  char* subpath = (char*)malloc(strlen(path) + strlen(folder->name) + 1 + 1);
-  strcpy(subpath, path);
-  strcat(subpath, folder->name);
-  strcat(subpath, "/");
-  printf("Visiting '%s'\n", subpath);
-  for(int i = 0; i < folder->folder_count; i++) {
-    extractFolder(subpath, folder->folders[i]);
+struct DedupStats {
+  unsigned int reflinked = 0;
+  unsigned int hardlinked = 0;
+  unsigned int copied = 0;
+  uint64_t linked_bytes = 0; // Reflinked or hardlinked, so not written at all
+  uint64_t copied_bytes = 0; // Read from the extracted file instead of the archive
+};
+
+static void createDuplicate(const std::string& original_path, const std::string& out_path, uint64_t size, DedupStats& stats) {
+  int in = open(original_path.c_str(), O_RDONLY);
+  if (in < 0) {
+    printf("Unable to open '%s'\n", original_path.c_str());
+    return;
+  }
+  int out = open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (out < 0) {
+    printf("Unable to open '%s'\n", out_path.c_str());
+    close(in);
+    return;
+  }
+
+#ifdef FICLONE
+  if (ioctl(out, FICLONE, in) == 0) {
+    stats.reflinked++;
+    stats.linked_bytes += size;
+    close(out);
+    close(in);
+    return;
   }
-  for(int i = 0; i < folder->file_count; i++) {
-    extractFile(subpath, folder->files[i]);
+#endif
+
+  if (dedup == DEDUP_HARDLINK) {
+    close(out);
+    unlink(out_path.c_str());
+    if (link(original_path.c_str(), out_path.c_str()) == 0) {
+      stats.hardlinked++;
+      stats.linked_bytes += size;
+      close(in);
+      return;
+    }
+    out = open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (out < 0) {
+      printf("Unable to open '%s'\n", out_path.c_str());
+      close(in);
+      return;
+    }
   }
-  free(subpath);
+
+  if (copyFile(in, out)) {
+    stats.copied++;
+    stats.copied_bytes += size;
+  } else {
+    printf("Unable to copy '%s' to '%s'\n", original_path.c_str(), out_path.c_str());
+  }
+  close(out);
+  close(in);
 }
 
-int main(int argc, char* argv[]) {
+// Runs after the originals have been extracted
+static void createDuplicates(const std::vector<Entry>& entries, const std::vector<Duplicate>& duplicates, const std::string& root) {
+  DedupStats stats;
+  for(const Duplicate& duplicate : duplicates) {
+    const Entry& original = entries[duplicate.original];
+    const Entry& entry = entries[duplicate.entry];
+    std::string original_path = root + original.path + original.file->name;
+    std::string out_path = prepareOutput((root + entry.path).c_str(), entry.file);
+    createDuplicate(original_path, out_path, entry.file->size, stats);
+  }
 
-  if (argc != 2) {
-    printf("Please provide an spk-path using `%s example.spk`\n", argv[0]);
-    return 1;
+  if (!duplicates.empty()) {
+    printf("Created %zu duplicates (%u reflinked, %u hardlinked, %u copied), %" PRIu64 " bytes shared, %" PRIu64 " bytes copied\n",
+           duplicates.size(), stats.reflinked, stats.hardlinked, stats.copied, stats.linked_bytes, stats.copied_bytes);
   }
-  char* path = argv[1];
+}
+
+// Output of --tar; "-" is stdout
+static const char* tar_path = NULL;
+static int tar_fd = -1;
+
+// Copies archive data in the kernel if possible
+static bool sendArchiveData(FILE* f, off_t offset, uint64_t size) {
+  static bool use_sendfile = true;
+  while(use_sendfile && size > 0) {
+    ssize_t sent = sendfile(tar_fd, fileno(f), &offset, std::min(size, (uint64_t)(1 << 30)));
+    if (sent <= 0) {
+      if (sent < 0 && errno == EINTR) {
+        continue;
+      }
+      if (sent < 0 && (errno == EINVAL || errno == ENOSYS)) {
+        use_sendfile = false;
+        break;
+      }
+      if (sent == 0) {
+        // The archive ends early
+        errno = EIO;
+      }
+      return false;
+    }
+    size -= sent;
+  }
+
+  std::vector<uint8_t> buffer(std::min(size, (uint64_t)SCHEDULE_CHUNK_SIZE));
+  while(size > 0) {
+    size_t length = std::min(size, (uint64_t)buffer.size());
+    if (!readArchive(f, buffer.data(), offset, length)) {
+      errno = EIO;
+      return false;
+    }
+    if (!tar_write_all(tar_fd, buffer.data(), length)) {
+      return false;
+    }
+    offset += length;
+    size -= length;
+  }
+  return true;
+}
+
+static bool sendFileData(File* file) {
+  std::vector<uint8_t> buffer(std::min((uint64_t)file->size, (uint64_t)SCHEDULE_CHUNK_SIZE));
+  for(off_t offset = 0; offset < (off_t)file->size;) {
+    size_t length = std::min((off_t)buffer.size(), (off_t)file->size - offset);
+    if (!file->read(buffer.data(), offset, length)) {
+      errno = EIO;
+      return false;
+    }
+    if (!tar_write_all(tar_fd, buffer.data(), length)) {
+      return false;
+    }
+    offset += length;
+  }
+  return true;
+}
+
+// Writes all entries as tar stream, in the order their data is stored in the archive
+static bool writeTar(FILE* f, const std::vector<Entry>& entries) {
+  std::vector<Duplicate> duplicates;
+  std::vector<Entry> unique = (dedup != DEDUP_OFF) ? findDuplicates(entries, duplicates) : entries;
+
+  std::stable_sort(unique.begin(), unique.end(), [](const Entry& a, const Entry& b) {
+    if ((a.file->offset < 0) != (b.file->offset < 0)) {
+      return b.file->offset < 0;
+    }
+    return a.file->offset < b.file->offset;
+  });
+
+  std::set<std::string> directories;
+  for(const Entry& entry : unique) {
+    File* file = entry.file;
+
+    // Folders are added before their first file
+    for(size_t slash = entry.path.find('/'); slash != std::string::npos; slash = entry.path.find('/', slash + 1)) {
+      std::string directory = entry.path.substr(0, slash + 1);
+      if (directories.insert(directory).second) {
+        if (!tar_write_header(tar_fd, directory, TAR_DIRECTORY, 0755, 0)) {
+          return false;
+        }
+      }
+    }
+
+    if (!tar_write_header(tar_fd, entry.path + file->name, TAR_REGULAR, file->permissions, file->size)) {
+      return false;
+    }
+    bool ok = (file->offset >= 0) ? sendArchiveData(f, file->offset, file->size) : sendFileData(file);
+    if (!ok || !tar_write_padding(tar_fd, file->size)) {
+      return false;
+    }
+  }
+
+  // Duplicates become hardlinks to the member which has the data
+  for(const Duplicate& duplicate : duplicates) {
+    const Entry& original = entries[duplicate.original];
+    const Entry& entry = entries[duplicate.entry];
+    if (!tar_write_header(tar_fd, entry.path + entry.file->name, TAR_HARDLINK, entry.file->permissions, 0, original.path + original.file->name)) {
+      return false;
+    }
+  }
+
+  return tar_write_end(tar_fd);
+}
+
+#ifdef HAVE_IO_URING
+struct AsyncOutput {
+  int fd;
+  unsigned int pending; // Writes in flight
+  bool finished; // All writes have been queued
+};
+
+// Same as extractEntries, but with many reads and writes in flight; returns false if the archive couldn't be read
+static bool extractEntriesAsync(IoRing* ring, FILE* f, const std::vector<Entry>& entries, const std::string& root) {
+  std::vector<File*> files;
+  for(const Entry& entry : entries) {
+    files.push_back(entry.file);
+  }
+  std::vector<AsyncOutput> outputs(entries.size(), { -1, 0, false });
+
+  auto closeIfDone = [&](unsigned int index) {
+    AsyncOutput& output = outputs[index];
+    if (output.finished && (output.pending == 0) && (output.fd >= 0)) {
+      close(output.fd);
+      output.fd = -1;
+    }
+  };
+
+  bool ok = scheduleReadsAsync(files.data(), files.size(), ring, fileno(f),
+    [&](unsigned int index, const void* data, off_t offset, size_t length) {
+      File* file = files[index];
+      AsyncOutput& output = outputs[index];
+      if (offset == 0) {
+        std::string out_path = prepareOutput((root + entries[index].path).c_str(), file);
+        output.fd = open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (output.fd < 0) {
+          printf("Unable to open '%s'\n", out_path.c_str());
+        }
+      }
+      if (output.fd < 0) {
+        return;
+      }
+      auto queueWrite = [&, index](const void* run, off_t run_offset, size_t run_length) {
+        outputs[index].pending++;
+        ioring_write(ring, outputs[index].fd, run, run_length, run_offset, [&, index](ssize_t result) {
+          if (result < 0) {
+            printf("Unable to write '%s' (%s)\n", files[index]->name, strerror(-result));
+          }
+          outputs[index].pending--;
+          closeIfDone(index);
+        });
+      };
+      if (sparse) {
+        sparse_split(data, offset, length, queueWrite);
+      } else {
+        queueWrite(data, offset, length);
+      }
+      if (offset + length == file->size) {
+        if (sparse) {
+          ftruncate(output.fd, file->size);
+        }
+        output.finished = true;
+        closeIfDone(index);
+      }
+    }
+  );
+
+  ioring_drain(ring);
+
+  // After a failed read, files which didn't get all their data are still open
+  for(AsyncOutput& output : outputs) {
+    if (output.fd >= 0) {
+      close(output.fd);
+    }
+  }
+
+  return ok;
+}
+#endif
+
+struct ArchiveResult {
+  std::string path;
+  size_t files;
+  uint64_t bytes;
+  double seconds;
+  int status;
+};
+
+// Extracts (or verifies) one SPK into root, which ends with a slash
+static int processArchive(const char* path, const std::string& root, ArchiveResult* result) {
+  auto start = std::chrono::steady_clock::now();
+  result->path = path;
+  result->files = 0;
+  result->bytes = 0;
+  result->seconds = 0.0;
 
-  uint8_t magic[4];
   FILE* f = fopen(path, "rb");
   if (f == NULL) {
     printf("Unable to open '%s'\n", path);
@@ -108,15 +676,284 @@ int main(int argc, char* argv[]) {
   Spk* spk = spk_parse(f);
   if (spk == NULL) {
     printf("Unable to parse SPK\n");
+    fclose(f);
     return 1;
   }
 
   Folder* root_folder = splitSpkIntoFoldersFromFILE(spk, f);
-  extractFolder("./", root_folder);
-  freeFolders(root_folder);
+#ifdef HAVE_ZLIB
+  // Indexing inflates all of header.tar.gz, so it's skipped if the folder isn't selected anyway
+  if (browse_header && isPackageSelected("header")) {
+    Folder* header_folder = splitHeaderIntoFoldersFromFILE(spk, f);
+    if (header_folder != NULL) {
+      addFolderToFolder(root_folder, header_folder);
+    }
+  }
+#endif
+
+  std::vector<Entry> entries;
+  collectRootFolder(root_folder, entries);
+  printf("Selected %zu files\n", entries.size());
 
+  int status = 0;
+  if (tar_path != NULL) {
+    if (!writeTar(f, entries)) {
+      fprintf(stderr, "Unable to write tar stream (%s)\n", strerror(errno));
+      status = 1;
+    }
+  } else if (verify) {
+    // Only files from packages have checksums
+    std::vector<Entry> checked;
+    for(const Entry& entry : entries) {
+      if (entry.file->spk_file != NULL) {
+        checked.push_back(entry);
+      }
+    }
+    entries = checked;
+
+    unsigned int failures = verifyEntries(f, entries, (key_path != NULL) ? key : NULL);
+    printf("%u of %zu files failed verification\n", failures, entries.size());
+    status = (failures > 0) ? 1 : 0;
+  } else {
+    std::vector<Duplicate> duplicates;
+    std::vector<Entry> unique = (dedup != DEDUP_OFF) ? findDuplicates(entries, duplicates) : entries;
+
+#ifdef HAVE_IO_URING
+    IoRing* ring = use_io_uring ? ioring_create(queue_depth) : NULL;
+    if (ring != NULL) {
+      if (!extractEntriesAsync(ring, f, unique, root)) {
+        status = 1;
+      }
+      ioring_free(ring);
+    } else
+#endif
+    if (!extractEntries(f, unique, root)) {
+      status = 1;
+    }
+
+    createDuplicates(entries, duplicates, root);
+  }
+
+  result->files = entries.size();
+  for(const Entry& entry : entries) {
+    result->bytes += entry.file->size;
+  }
+
+  freeFolders(root_folder);
   spk_free(spk);
+  fclose(f);
 
+  result->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return status;
+}
 
-  return 0;
-}
\ No newline at end of file
+// Each line of a batch list is "<example.spk> [output-folder]"; '#' starts a comment.
+// Without an output folder, the name of the SPK without extension is used.
+static bool readBatchList(const char* list_path, std::vector<std::pair<std::string, std::string>>& archives) {
+  FILE* f = fopen(list_path, "rb");
+  if (f == NULL) {
+    printf("Unable to open '%s'\n", list_path);
+    return false;
+  }
+
+  char line[PATH_MAX * 2];
+  while(fgets(line, sizeof(line), f) != NULL) {
+    char* comment = strchr(line, '#');
+    if (comment != NULL) {
+      *comment = '\0';
+    }
+    char* save = NULL;
+    char* path = strtok_r(line, " \t\r\n", &save);
+    if (path == NULL) {
+      continue;
+    }
+    char* root = strtok_r(NULL, " \t\r\n", &save);
+
+    std::string out;
+    if (root != NULL) {
+      out = root;
+    } else {
+      const char* slash = strrchr(path, '/');
+      out = (slash != NULL) ? &slash[1] : path;
+      size_t dot = out.rfind('.');
+      if (dot != std::string::npos && dot > 0) {
+        out.resize(dot);
+      }
+    }
+    if (out.empty()) {
+      printf("No output folder for '%s' in '%s'\n", path, list_path);
+      fclose(f);
+      return false;
+    }
+    if (out.back() != '/') {
+      out += '/';
+    }
+    archives.push_back({ path, out });
+  }
+
+  fclose(f);
+  return true;
+}
+
+static void printReport(const std::vector<ArchiveResult>& results) {
+  printf("\n%10s %14s %9s %10s  %s\n", "Files", "Bytes", "Seconds", "MiB/s", "Archive");
+  uint64_t total_bytes = 0;
+  for(const ArchiveResult& result : results) {
+    double throughput = (result.seconds > 0.0) ? (result.bytes / result.seconds / (1024.0 * 1024.0)) : 0.0;
+    printf("%10zu %14" PRIu64 " %9.2f %10.1f  %s%s\n", result.files, result.bytes, result.seconds, throughput,
+           result.path.c_str(), (result.status != 0) ? " (failed)" : "");
+    total_bytes += result.bytes;
+  }
+  printf("%10s %14" PRIu64 "\n", "Total", total_bytes);
+}
+
+static void show_help(const char* progname) {
+  printf("usage: %s [options] <example.spk>\n", progname);
+  printf("       %s [options] --batch=LIST\n\n", progname);
+  printf("    -p, --package=NAME     only extract packages matching NAME (repeatable)\n");
+  printf("    -i, --include=GLOB     only extract paths matching GLOB (repeatable)\n");
+  printf("    -x, --exclude=GLOB     skip paths matching GLOB (repeatable)\n");
+  printf("    --verify               check files against the index instead of extracting\n");
+  printf("    --key=FILE             factory key, so --verify also checks the HMAC\n");
+  printf("    --batch=LIST           process every '<example.spk> [output-folder]' line of LIST\n");
+  printf("    --max-io=N             limit blocking reads / writes in flight across all archives\n");
+  printf("    --sparse               don't write blocks of zeros, so output files are sparse\n");
+  printf("    --tar=FILE             write a tar stream to FILE ('-' for stdout) instead of a folder tree\n");
+  printf("    --dedup[=FALLBACK]     extract files with the same MD5 and size once and reflink the others;\n");
+  printf("                           FALLBACK is 'copy' (default) or 'hardlink' if reflinks aren't supported\n");
+#ifdef HAVE_ZLIB
+  printf("    --browse-header        also extract the members of header.tar.gz into 'header/'\n");
+#endif
+#ifdef HAVE_IO_URING
+  printf("    --io-uring             use io_uring to keep many reads and writes in flight\n");
+  printf("    --queue-depth=N        number of requests in flight for --io-uring (default: %d)\n", IORING_DEFAULT_QUEUE_DEPTH);
+#endif
+  printf("\n");
+  printf("Packages match by name or folder name; globs match the output path (like 'game-1_02_0/config/game.json').\n");
+}
+
+int main(int argc, char* argv[]) {
+
+  static const struct option long_options[] = {
+    { "package", required_argument, NULL, 'p' },
+    { "include", required_argument, NULL, 'i' },
+    { "exclude", required_argument, NULL, 'x' },
+    { "verify", no_argument, NULL, 'V' },
+    { "key", required_argument, NULL, 'K' },
+    { "batch", required_argument, NULL, 'B' },
+    { "max-io", required_argument, NULL, 'M' },
+    { "dedup", optional_argument, NULL, 'D' },
+    { "sparse", no_argument, NULL, 'S' },
+    { "tar", required_argument, NULL, 'T' },
+    { "help", no_argument, NULL, 'h' },
+#ifdef HAVE_ZLIB
+    { "browse-header", no_argument, NULL, 'H' },
+#endif
+#ifdef HAVE_IO_URING
+    { "io-uring", no_argument, NULL, 'U' },
+    { "queue-depth", required_argument, NULL, 'Q' },
+#endif
+    { NULL, 0, NULL, 0 }
+  };
+
+  int c;
+  while((c = getopt_long(argc, argv, "p:i:x:h", long_options, NULL)) != -1) {
+    switch(c) {
+      case 'p': packages.push_back(optarg); break;
+      case 'i': includes.push_back(optarg); break;
+      case 'x': excludes.push_back(optarg); break;
+      case 'V': verify = true; break;
+      case 'K': key_path = optarg; break;
+      case 'B': batch_path = optarg; break;
+      case 'M': pool_set_max_io(atoi(optarg)); break;
+      case 'S': sparse = true; break;
+      case 'T': tar_path = optarg; break;
+      case 'D':
+        if (optarg == NULL || !strcmp(optarg, "copy")) {
+          dedup = DEDUP_COPY;
+        } else if (!strcmp(optarg, "hardlink")) {
+          dedup = DEDUP_HARDLINK;
+        } else {
+          printf("Unknown --dedup fallback '%s'\n", optarg);
+          return 1;
+        }
+        break;
+#ifdef HAVE_ZLIB
+      case 'H': browse_header = true; break;
+#endif
+#ifdef HAVE_IO_URING
+      case 'U': use_io_uring = true; break;
+      case 'Q': queue_depth = atoi(optarg); break;
+#endif
+      case 'h':
+        show_help(argv[0]);
+        return 0;
+      default:
+        show_help(argv[0]);
+        return 1;
+    }
+  }
+
+  if (key_path != NULL && !readFactoryKey(key_path, key)) {
+    return 1;
+  }
+
+  if (tar_path != NULL) {
+    if (batch_path != NULL || verify) {
+      printf("--tar can't be used with --batch or --verify\n");
+      return 1;
+    }
+    if (!strcmp(tar_path, "-")) {
+      // Messages go to stderr, so they don't end up in the stream
+      tar_fd = dup(STDOUT_FILENO);
+      dup2(STDERR_FILENO, STDOUT_FILENO);
+    } else {
+      tar_fd = open(tar_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    }
+    if (tar_fd < 0) {
+      printf("Unable to open '%s'\n", tar_path);
+      return 1;
+    }
+  }
+
+  // Archives of a batch are processed by the shared pool
+  if (batch_path != NULL) {
+    if (optind != argc) {
+      printf("No spk-path can be given with --batch\n");
+      return 1;
+    }
+    std::vector<std::pair<std::string, std::string>> archives;
+    if (!readBatchList(batch_path, archives)) {
+      return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<ArchiveResult> results(archives.size());
+    parallelFor(archives.size(), [&](unsigned int i) {
+      results[i].status = processArchive(archives[i].first.c_str(), archives[i].second, &results[i]);
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printReport(results);
+    printf("Processed %zu archives in %.2f seconds using %u threads\n", archives.size(), seconds, pool_size());
+
+    for(const ArchiveResult& result : results) {
+      if (result.status != 0) {
+        return 1;
+      }
+    }
+    return 0;
+  }
+
+  if (optind != argc - 1) {
+    printf("Please provide an spk-path using `%s example.spk`\n", argv[0]);
+    return 1;
+  }
+
+  ArchiveResult result;
+  int status = processArchive(argv[optind], "./", &result);
+  if (tar_fd >= 0) {
+    close(tar_fd);
+  }
+  return status;
+}
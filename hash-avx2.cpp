@@ -0,0 +1,15 @@
+// Copyright (C) 2018 Jannik Vogel
+
+// Built with -mavx2; only called if the CPU supports it
+
+#include "hash-mb.h"
+
+typedef uint32_t v8u __attribute__((vector_size(32)));
+
+void md5_x8(uint32_t state[4][8], const uint8_t* const data[8], size_t blocks) {
+  md5Blocks<v8u, 8>(state, data, blocks);
+}
+
+void sha1_x8(uint32_t state[5][8], const uint8_t* const data[8], size_t blocks) {
+  sha1Blocks<v8u, 8>(state, data, blocks);
+}
@@ -0,0 +1,15 @@
+// Copyright (C) 2018 Jannik Vogel
+
+// Built with -mavx512f; only called if the CPU supports it
+
+#include "hash-mb.h"
+
+typedef uint32_t v16u __attribute__((vector_size(64)));
+
+void md5_x16(uint32_t state[4][16], const uint8_t* const data[16], size_t blocks) {
+  md5Blocks<v16u, 16>(state, data, blocks);
+}
+
+void sha1_x16(uint32_t state[5][16], const uint8_t* const data[16], size_t blocks) {
+  sha1Blocks<v16u, 16>(state, data, blocks);
+}
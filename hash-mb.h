@@ -0,0 +1,175 @@
+// Copyright (C) 2018 Jannik Vogel
+
+#pragma once
+
+// Multi-buffer MD5 / SHA-1 block functions: every vector lane hashes a different
+// message, so wide vector units can be used although each hash is sequential.
+// This is included by a source file per instruction set, so everything in here
+// must have internal linkage.
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+namespace {
+
+template<typename V>
+static inline V rotl(V x, int n) {
+  return (x << n) | (x >> (32 - n));
+}
+
+static inline uint32_t load32le(const uint8_t* p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+static inline uint32_t load32be(const uint8_t* p) {
+  return __builtin_bswap32(load32le(p));
+}
+
+static const uint32_t md5K[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const int md5S[4][4] = {
+  { 7, 12, 17, 22 },
+  { 5, 9, 14, 20 },
+  { 4, 11, 16, 23 },
+  { 6, 10, 15, 21 }
+};
+
+// state is [word][lane]; every lane processes `blocks` 64 byte blocks from data[lane]
+template<typename V, int N>
+static void md5Blocks(uint32_t state[4][N], const uint8_t* const data[N], size_t blocks) {
+  V h[4];
+  memcpy(h, state, sizeof(h));
+
+  const uint8_t* p[N];
+  memcpy(p, data, sizeof(p));
+
+  for(size_t block = 0; block < blocks; block++) {
+    V w[16];
+    for(int j = 0; j < 16; j++) {
+      for(int lane = 0; lane < N; lane++) {
+        w[j][lane] = load32le(&p[lane][j * 4]);
+      }
+    }
+
+    V a = h[0];
+    V b = h[1];
+    V c = h[2];
+    V d = h[3];
+    for(int i = 0; i < 64; i++) {
+      V f;
+      int g;
+      if (i < 16) {
+        f = d ^ (b & (c ^ d));
+        g = i;
+      } else if (i < 32) {
+        f = c ^ (d & (b ^ c));
+        g = (5 * i + 1) % 16;
+      } else if (i < 48) {
+        f = b ^ c ^ d;
+        g = (3 * i + 5) % 16;
+      } else {
+        f = c ^ (b | ~d);
+        g = (7 * i) % 16;
+      }
+      V t = d;
+      d = c;
+      c = b;
+      b = b + rotl(a + f + md5K[i] + w[g], md5S[i / 16][i % 4]);
+      a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+
+    for(int lane = 0; lane < N; lane++) {
+      p[lane] += 64;
+    }
+  }
+
+  memcpy(state, h, sizeof(h));
+}
+
+// state is [word][lane]; every lane processes `blocks` 64 byte blocks from data[lane]
+template<typename V, int N>
+static void sha1Blocks(uint32_t state[5][N], const uint8_t* const data[N], size_t blocks) {
+  V h[5];
+  memcpy(h, state, sizeof(h));
+
+  const uint8_t* p[N];
+  memcpy(p, data, sizeof(p));
+
+  for(size_t block = 0; block < blocks; block++) {
+    V w[80];
+    for(int j = 0; j < 16; j++) {
+      for(int lane = 0; lane < N; lane++) {
+        w[j][lane] = load32be(&p[lane][j * 4]);
+      }
+    }
+    for(int j = 16; j < 80; j++) {
+      w[j] = rotl(w[j - 3] ^ w[j - 8] ^ w[j - 14] ^ w[j - 16], 1);
+    }
+
+    V a = h[0];
+    V b = h[1];
+    V c = h[2];
+    V d = h[3];
+    V e = h[4];
+    for(int i = 0; i < 80; i++) {
+      V f;
+      uint32_t k;
+      if (i < 20) {
+        f = d ^ (b & (c ^ d));
+        k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (d & (b | c));
+        k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xCA62C1D6;
+      }
+      V t = rotl(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = rotl(b, 30);
+      b = a;
+      a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+
+    for(int lane = 0; lane < N; lane++) {
+      p[lane] += 64;
+    }
+  }
+
+  memcpy(state, h, sizeof(h));
+}
+
+}
+
+// Block functions for each lane count, see md5Blocks / sha1Blocks
+void md5_x4(uint32_t state[4][4], const uint8_t* const data[4], size_t blocks);
+void sha1_x4(uint32_t state[5][4], const uint8_t* const data[4], size_t blocks);
+void md5_x8(uint32_t state[4][8], const uint8_t* const data[8], size_t blocks);
+void sha1_x8(uint32_t state[5][8], const uint8_t* const data[8], size_t blocks);
+void md5_x16(uint32_t state[4][16], const uint8_t* const data[16], size_t blocks);
+void sha1_x16(uint32_t state[5][16], const uint8_t* const data[16], size_t blocks);
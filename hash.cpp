@@ -0,0 +1,312 @@
+// Copyright (C) 2018 Jannik Vogel
+
+#include <cstdint>
+#include <cstring>
+
+#include <vector>
+#include <algorithm>
+
+#include "hash.h"
+#include "hash-mb.h"
+
+// Generic vectors; this is SSE2 on x86-64 and NEON on ARM
+typedef uint32_t v1u __attribute__((vector_size(4)));
+typedef uint32_t v4u __attribute__((vector_size(16)));
+
+void md5_x4(uint32_t state[4][4], const uint8_t* const data[4], size_t blocks) {
+  md5Blocks<v4u, 4>(state, data, blocks);
+}
+
+void sha1_x4(uint32_t state[5][4], const uint8_t* const data[4], size_t blocks) {
+  sha1Blocks<v4u, 4>(state, data, blocks);
+}
+
+static void md5_x1(uint32_t state[4], const uint8_t* data, size_t blocks) {
+  md5Blocks<v1u, 1>((uint32_t(*)[1])state, &data, blocks);
+}
+
+static void sha1_x1(uint32_t state[5], const uint8_t* data, size_t blocks) {
+  sha1Blocks<v1u, 1>((uint32_t(*)[1])state, &data, blocks);
+}
+
+static const uint32_t md5Iv[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+static const uint32_t sha1Iv[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+struct Segment {
+  HashState* state;
+  const uint8_t* data;
+  size_t blocks;
+};
+
+struct Hasher {
+  unsigned int lanes;
+  bool hmac;
+  uint32_t ipad[5]; // SHA-1 state after the inner / outer key block
+  uint32_t opad[5];
+  std::vector<Segment> segments;
+};
+
+static void store32be(uint8_t* p, uint32_t v) {
+  v = __builtin_bswap32(v);
+  memcpy(p, &v, 4);
+}
+
+static void store64be(uint8_t* p, uint64_t v) {
+  v = __builtin_bswap64(v);
+  memcpy(p, &v, 8);
+}
+
+static void compress(Hasher* hasher, HashState* state, const uint8_t* data, size_t blocks) {
+  md5_x1(state->md5, data, blocks);
+  if (hasher->hmac) {
+    sha1_x1(state->sha1, data, blocks);
+  }
+}
+
+// Keeps N lanes busy: whenever a lane runs out of data, the next segment takes its place
+template<int N>
+static void runLanes(Hasher* hasher,
+                     void (*md5)(uint32_t[4][N], const uint8_t* const[N], size_t),
+                     void (*sha1)(uint32_t[5][N], const uint8_t* const[N], size_t)) {
+  std::vector<Segment>& segments = hasher->segments;
+  int active[N];
+  size_t done[N];
+  uint32_t md5State[4][N] = {};
+  uint32_t sha1State[5][N] = {};
+  for(int lane = 0; lane < N; lane++) {
+    active[lane] = -1;
+  }
+
+  size_t next = 0;
+  while(true) {
+    int count = 0;
+    int last = -1;
+    for(int lane = 0; lane < N; lane++) {
+      if (active[lane] < 0 && next < segments.size()) {
+        active[lane] = next++;
+        done[lane] = 0;
+        HashState* state = segments[active[lane]].state;
+        for(int i = 0; i < 4; i++) {
+          md5State[i][lane] = state->md5[i];
+        }
+        for(int i = 0; i < 5; i++) {
+          sha1State[i][lane] = state->sha1[i];
+        }
+      }
+      if (active[lane] >= 0) {
+        count++;
+        last = lane;
+      }
+    }
+    if (count == 0) {
+      break;
+    }
+
+    // A single lane is faster on its own
+    if (count == 1) {
+      Segment& segment = segments[active[last]];
+      for(int i = 0; i < 4; i++) {
+        segment.state->md5[i] = md5State[i][last];
+      }
+      for(int i = 0; i < 5; i++) {
+        segment.state->sha1[i] = sha1State[i][last];
+      }
+      compress(hasher, segment.state, &segment.data[done[last] * 64], segment.blocks - done[last]);
+      segment.state->queued = false;
+      active[last] = -1;
+      continue;
+    }
+
+    // Idle lanes hash the same data as an active lane and the result is dropped
+    size_t blocks = SIZE_MAX;
+    const uint8_t* data[N];
+    for(int lane = 0; lane < N; lane++) {
+      if (active[lane] >= 0) {
+        const Segment& segment = segments[active[lane]];
+        blocks = std::min(blocks, segment.blocks - done[lane]);
+        data[lane] = &segment.data[done[lane] * 64];
+      }
+    }
+    for(int lane = 0; lane < N; lane++) {
+      if (active[lane] < 0) {
+        data[lane] = data[last];
+      }
+    }
+
+    md5(md5State, data, blocks);
+    if (hasher->hmac) {
+      sha1(sha1State, data, blocks);
+    }
+
+    for(int lane = 0; lane < N; lane++) {
+      if (active[lane] < 0) {
+        continue;
+      }
+      done[lane] += blocks;
+      Segment& segment = segments[active[lane]];
+      if (done[lane] == segment.blocks) {
+        for(int i = 0; i < 4; i++) {
+          segment.state->md5[i] = md5State[i][lane];
+        }
+        for(int i = 0; i < 5; i++) {
+          segment.state->sha1[i] = sha1State[i][lane];
+        }
+        segment.state->queued = false;
+        active[lane] = -1;
+      }
+    }
+  }
+}
+
+Hasher* hasher_create(const uint8_t* hmac_key, size_t hmac_key_length) {
+  Hasher* hasher = new Hasher();
+
+  hasher->lanes = 4;
+#ifdef HAVE_HASH_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    hasher->lanes = 16;
+  } else if (__builtin_cpu_supports("avx2")) {
+    hasher->lanes = 8;
+  }
+#endif
+
+  hasher->hmac = (hmac_key != NULL);
+  if (hasher->hmac) {
+    uint8_t key[64] = { 0 };
+    if (hmac_key_length > sizeof(key)) {
+      // Long keys are hashed first
+      uint32_t digest[5];
+      memcpy(digest, sha1Iv, sizeof(digest));
+      size_t blocks = hmac_key_length / 64;
+      sha1_x1(digest, hmac_key, blocks);
+      uint8_t tail[128] = { 0 };
+      size_t remaining = hmac_key_length % 64;
+      memcpy(tail, &hmac_key[blocks * 64], remaining);
+      tail[remaining] = 0x80;
+      size_t count = (remaining < 56) ? 1 : 2;
+      store64be(&tail[count * 64 - 8], hmac_key_length * 8);
+      sha1_x1(digest, tail, count);
+      for(int i = 0; i < 5; i++) {
+        store32be(&key[i * 4], digest[i]);
+      }
+    } else {
+      memcpy(key, hmac_key, hmac_key_length);
+    }
+
+    uint8_t block[64];
+    for(int i = 0; i < 64; i++) {
+      block[i] = key[i] ^ 0x36;
+    }
+    memcpy(hasher->ipad, sha1Iv, sizeof(sha1Iv));
+    sha1_x1(hasher->ipad, block, 1);
+    for(int i = 0; i < 64; i++) {
+      block[i] = key[i] ^ 0x5C;
+    }
+    memcpy(hasher->opad, sha1Iv, sizeof(sha1Iv));
+    sha1_x1(hasher->opad, block, 1);
+  }
+
+  return hasher;
+}
+
+void hasher_free(Hasher* hasher) {
+  delete hasher;
+}
+
+unsigned int hasher_lanes(Hasher* hasher) {
+  return hasher->lanes;
+}
+
+void hasher_begin(Hasher* hasher, HashState* state) {
+  memcpy(state->md5, md5Iv, sizeof(md5Iv));
+  if (hasher->hmac) {
+    memcpy(state->sha1, hasher->ipad, sizeof(hasher->ipad));
+  } else {
+    memcpy(state->sha1, sha1Iv, sizeof(sha1Iv));
+  }
+  state->buffered = 0;
+  state->length = 0;
+  state->queued = false;
+}
+
+void hasher_update(Hasher* hasher, HashState* state, const void* data, size_t length) {
+  // Blocks of a file must be hashed in order
+  if (state->queued) {
+    hasher_flush(hasher);
+  }
+
+  const uint8_t* p = (const uint8_t*)data;
+  state->length += length;
+
+  if (state->buffered > 0) {
+    size_t count = std::min(sizeof(state->buffer) - state->buffered, length);
+    memcpy(&state->buffer[state->buffered], p, count);
+    state->buffered += count;
+    p += count;
+    length -= count;
+    if (state->buffered < sizeof(state->buffer)) {
+      return;
+    }
+    compress(hasher, state, state->buffer, 1);
+    state->buffered = 0;
+  }
+
+  size_t blocks = length / 64;
+  if (blocks > 0) {
+    hasher->segments.push_back({ state, p, blocks });
+    state->queued = true;
+  }
+
+  state->buffered = length % 64;
+  memcpy(state->buffer, &p[blocks * 64], state->buffered);
+}
+
+void hasher_flush(Hasher* hasher) {
+  switch(hasher->lanes) {
+#ifdef HAVE_HASH_X86
+    case 16: runLanes<16>(hasher, md5_x16, sha1_x16); break;
+    case 8: runLanes<8>(hasher, md5_x8, sha1_x8); break;
+#endif
+    default: runLanes<4>(hasher, md5_x4, sha1_x4); break;
+  }
+  hasher->segments.clear();
+}
+
+void hasher_final(Hasher* hasher, HashState* state, uint8_t md5[16], uint8_t hmac[20]) {
+  if (state->queued) {
+    hasher_flush(hasher);
+  }
+
+  // Padding is the same, except for the length
+  uint8_t blocks[128] = { 0 };
+  memcpy(blocks, state->buffer, state->buffered);
+  blocks[state->buffered] = 0x80;
+  size_t count = (state->buffered < 56) ? 1 : 2;
+  uint8_t* lengthField = &blocks[count * 64 - 8];
+
+  uint64_t bits = state->length * 8;
+  memcpy(lengthField, &bits, 8);
+  md5_x1(state->md5, blocks, count);
+  memcpy(md5, state->md5, 16);
+
+  if (hasher->hmac) {
+    store64be(lengthField, (64 + state->length) * 8);
+    sha1_x1(state->sha1, blocks, count);
+
+    uint8_t outer[64] = { 0 };
+    for(int i = 0; i < 5; i++) {
+      store32be(&outer[i * 4], state->sha1[i]);
+    }
+    outer[20] = 0x80;
+    store64be(&outer[56], (64 + 20) * 8);
+    uint32_t digest[5];
+    memcpy(digest, hasher->opad, sizeof(digest));
+    sha1_x1(digest, outer, 1);
+    if (hmac != NULL) {
+      for(int i = 0; i < 5; i++) {
+        store32be(&hmac[i * 4], digest[i]);
+      }
+    }
+  }
+}
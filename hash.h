@@ -0,0 +1,40 @@
+// Copyright (C) 2018 Jannik Vogel
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Streaming MD5 and HMAC-SHA1 (as stored in FINF / FI64) for many files at once.
+// Blocks of different files are hashed side by side in SIMD lanes; the number of
+// lanes depends on what the CPU supports.
+
+// Per-file state
+typedef struct HashState_ {
+  uint32_t md5[4];
+  uint32_t sha1[5]; // Inner HMAC hash
+  uint8_t buffer[64]; // Data which doesn't fill a block yet
+  size_t buffered;
+  uint64_t length;
+  bool queued; // Has data in the current batch
+} HashState;
+
+struct Hasher;
+
+// The HMAC is only calculated if a key is given
+Hasher* hasher_create(const uint8_t* hmac_key, size_t hmac_key_length);
+void hasher_free(Hasher* hasher);
+
+// Number of files which are hashed at the same time
+unsigned int hasher_lanes(Hasher* hasher);
+
+void hasher_begin(Hasher* hasher, HashState* state);
+
+// Queues data for hashing; it must stay valid until the next hasher_flush()
+void hasher_update(Hasher* hasher, HashState* state, const void* data, size_t length);
+
+// Hashes everything which was queued
+void hasher_flush(Hasher* hasher);
+
+// Flushes and writes the results; hmac is left untouched if there is no key
+void hasher_final(Hasher* hasher, HashState* state, uint8_t md5[16], uint8_t hmac[20]);
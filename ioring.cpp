@@ -0,0 +1,340 @@
+// Copyright (C) 2018 Jannik Vogel
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <cerrno>
+
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "ioring.h"
+#include "pool.h"
+
+struct IoRequest {
+  uint8_t opcode;
+  int fd;
+  int buffer; // Registered buffer which holds data, or -1
+  uint8_t* data;
+  size_t length;
+  off_t offset;
+  size_t done;
+  IoRingCb cb;
+};
+
+struct IoRing {
+  int fd;
+  unsigned int entries;
+
+  void* sq_ring;
+  size_t sq_ring_size;
+  void* cq_ring;
+  size_t cq_ring_size;
+  struct io_uring_sqe* sqes;
+  size_t sqes_size;
+
+  unsigned int* sq_tail;
+  unsigned int* sq_mask;
+  unsigned int* sq_array;
+  unsigned int* cq_head;
+  unsigned int* cq_tail;
+  unsigned int* cq_mask;
+  struct io_uring_cqe* cqes;
+
+  unsigned int queued; // Prepared, but not submitted yet
+  unsigned int in_flight; // Prepared or submitted, but not completed yet
+
+  uint8_t* buffers;
+  unsigned int buffer_count;
+  bool registered; // Buffers are registered, so we can use fixed transfers
+  std::vector<unsigned int> buffer_refs;
+  std::vector<int> free_buffers;
+};
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params* params) {
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags) {
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned int opcode, void* arg, unsigned int nr_args) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void* mapRing(int fd, size_t size, off_t offset) {
+  void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+  return (ptr == MAP_FAILED) ? NULL : ptr;
+}
+
+// Unmaps whatever mapRing() managed to map
+static void unmapRings(IoRing* ring) {
+  if (ring->sqes != NULL) {
+    munmap(ring->sqes, ring->sqes_size);
+  }
+  if (ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring) {
+    munmap(ring->cq_ring, ring->cq_ring_size);
+  }
+  if (ring->sq_ring != NULL) {
+    munmap(ring->sq_ring, ring->sq_ring_size);
+  }
+}
+
+IoRing* ioring_create(unsigned int queue_depth) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int fd = io_uring_setup(queue_depth, &params);
+  if (fd < 0) {
+    printf("Unable to set up io_uring (%s)\n", strerror(errno));
+    return NULL;
+  }
+
+  IoRing* ring = new IoRing();
+  ring->fd = fd;
+  ring->entries = params.sq_entries;
+  ring->queued = 0;
+  ring->in_flight = 0;
+
+  ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    if (ring->cq_ring_size > ring->sq_ring_size) {
+      ring->sq_ring_size = ring->cq_ring_size;
+    }
+    ring->cq_ring_size = ring->sq_ring_size;
+  }
+  ring->sq_ring = mapRing(fd, ring->sq_ring_size, IORING_OFF_SQ_RING);
+  ring->cq_ring = single_mmap ? ring->sq_ring : mapRing(fd, ring->cq_ring_size, IORING_OFF_CQ_RING);
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = (struct io_uring_sqe*)mapRing(fd, ring->sqes_size, IORING_OFF_SQES);
+  if (ring->sq_ring == NULL || ring->cq_ring == NULL || ring->sqes == NULL) {
+    printf("Unable to map io_uring (%s)\n", strerror(errno));
+    unmapRings(ring);
+    close(fd);
+    delete ring;
+    return NULL;
+  }
+
+  uint8_t* sq = (uint8_t*)ring->sq_ring;
+  ring->sq_tail = (unsigned int*)&sq[params.sq_off.tail];
+  ring->sq_mask = (unsigned int*)&sq[params.sq_off.ring_mask];
+  ring->sq_array = (unsigned int*)&sq[params.sq_off.array];
+  uint8_t* cq = (uint8_t*)ring->cq_ring;
+  ring->cq_head = (unsigned int*)&cq[params.cq_off.head];
+  ring->cq_tail = (unsigned int*)&cq[params.cq_off.tail];
+  ring->cq_mask = (unsigned int*)&cq[params.cq_off.ring_mask];
+  ring->cqes = (struct io_uring_cqe*)&cq[params.cq_off.cqes];
+
+  // One buffer per entry, so every request in flight can have one
+  ring->buffer_count = ring->entries;
+  ring->buffers = (uint8_t*)aligned_alloc(4096, ring->buffer_count * IORING_BUFFER_SIZE);
+  if (ring->buffers == NULL) {
+    printf("Unable to allocate io_uring buffers\n");
+    unmapRings(ring);
+    close(fd);
+    delete ring;
+    return NULL;
+  }
+  ring->buffer_refs.resize(ring->buffer_count, 0);
+  std::vector<struct iovec> iovecs(ring->buffer_count);
+  for(unsigned int i = 0; i < ring->buffer_count; i++) {
+    iovecs[i].iov_base = ioring_buffer_data(ring, i);
+    iovecs[i].iov_len = IORING_BUFFER_SIZE;
+    ring->free_buffers.push_back(ring->buffer_count - 1 - i);
+  }
+
+  // This can fail if the memlock limit is too low; we'll still work, just slower
+  ring->registered = io_uring_register(fd, IORING_REGISTER_BUFFERS, iovecs.data(), ring->buffer_count) == 0;
+  if (!ring->registered) {
+    printf("Unable to register io_uring buffers (%s)\n", strerror(errno));
+  }
+
+  return ring;
+}
+
+void ioring_free(IoRing* ring) {
+  ioring_drain(ring);
+  unmapRings(ring);
+  close(ring->fd);
+  free(ring->buffers);
+  delete ring;
+}
+
+int ioring_try_acquire_buffer(IoRing* ring) {
+  if (ring->free_buffers.empty()) {
+    return -1;
+  }
+  int buffer = ring->free_buffers.back();
+  ring->free_buffers.pop_back();
+  ring->buffer_refs[buffer] = 1;
+  return buffer;
+}
+
+void ioring_release_buffer(IoRing* ring, int buffer) {
+  assert(ring->buffer_refs[buffer] > 0);
+  if (--ring->buffer_refs[buffer] == 0) {
+    ring->free_buffers.push_back(buffer);
+  }
+}
+
+uint8_t* ioring_buffer_data(IoRing* ring, int buffer) {
+  return &ring->buffers[(size_t)buffer * IORING_BUFFER_SIZE];
+}
+
+size_t ioring_buffer_size(IoRing* ring) {
+  return IORING_BUFFER_SIZE;
+}
+
+static int findBuffer(IoRing* ring, const void* data, size_t length) {
+  const uint8_t* p = (const uint8_t*)data;
+  if (p < ring->buffers || p >= &ring->buffers[(size_t)ring->buffer_count * IORING_BUFFER_SIZE]) {
+    return -1;
+  }
+  int buffer = (p - ring->buffers) / IORING_BUFFER_SIZE;
+  assert(&p[length] <= &ioring_buffer_data(ring, buffer)[IORING_BUFFER_SIZE]);
+  return buffer;
+}
+
+static void submitRequest(IoRing* ring, IoRequest* request) {
+  while(ring->in_flight >= ring->entries) {
+    ioring_wait(ring);
+  }
+
+  // We are the only producer, so our own tail needs no barrier
+  unsigned int tail = *ring->sq_tail;
+  unsigned int index = tail & *ring->sq_mask;
+  struct io_uring_sqe* sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+
+  bool fixed = ring->registered && (request->buffer >= 0);
+  if (request->opcode == IORING_OP_READ) {
+    sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+  } else {
+    sqe->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+  }
+  sqe->fd = request->fd;
+  sqe->addr = (uint64_t)(uintptr_t)&request->data[request->done];
+  sqe->len = request->length - request->done;
+  sqe->off = request->offset + request->done;
+  if (fixed) {
+    sqe->buf_index = request->buffer;
+  }
+  sqe->user_data = (uint64_t)(uintptr_t)request;
+
+  ring->sq_array[index] = index;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ring->queued++;
+  ring->in_flight++;
+}
+
+static void completeRequest(IoRing* ring, IoRequest* request, int32_t res) {
+  ring->in_flight--;
+
+  if ((res == -EINTR) || (res == -EAGAIN)) {
+    submitRequest(ring, request);
+    return;
+  }
+
+  // Continue short transfers, unless we hit the end of the file
+  if (res > 0) {
+    request->done += res;
+    if (request->done < request->length) {
+      submitRequest(ring, request);
+      return;
+    }
+  }
+
+  // The slot is kept while short transfers are continued
+  pool_release_io();
+  if (request->cb) {
+    request->cb((res < 0) ? res : request->done);
+  }
+  if (request->buffer >= 0) {
+    ioring_release_buffer(ring, request->buffer);
+  }
+  delete request;
+}
+
+// Requests count against the I/O limit of the pool, like blocking reads / writes.
+// While we can't get a slot, our own completions are processed, as they free slots, too.
+static void acquireIoSlot(IoRing* ring) {
+  while(!pool_try_acquire_io()) {
+    if (ring->in_flight == 0) {
+      pool_acquire_io();
+      return;
+    }
+    ioring_wait(ring);
+  }
+}
+
+static void queueRequest(IoRing* ring, uint8_t opcode, int fd, void* data, size_t length, off_t offset, IoRingCb cb) {
+  if (length == 0) {
+    if (cb) {
+      cb(0);
+    }
+    return;
+  }
+
+  acquireIoSlot(ring);
+
+  IoRequest* request = new IoRequest();
+  request->opcode = opcode;
+  request->fd = fd;
+  request->buffer = findBuffer(ring, data, length);
+  request->data = (uint8_t*)data;
+  request->length = length;
+  request->offset = offset;
+  request->done = 0;
+  request->cb = cb;
+  if (request->buffer >= 0) {
+    ring->buffer_refs[request->buffer]++;
+  }
+  submitRequest(ring, request);
+}
+
+void ioring_read(IoRing* ring, int fd, void* data, size_t length, off_t offset, IoRingCb cb) {
+  queueRequest(ring, IORING_OP_READ, fd, data, length, offset, cb);
+}
+
+void ioring_write(IoRing* ring, int fd, const void* data, size_t length, off_t offset, IoRingCb cb) {
+  queueRequest(ring, IORING_OP_WRITE, fd, (void*)data, length, offset, cb);
+}
+
+void ioring_wait(IoRing* ring) {
+  assert(ring->in_flight > 0);
+
+  int ret;
+  do {
+    ret = io_uring_enter(ring->fd, ring->queued, 1, IORING_ENTER_GETEVENTS);
+  } while((ret < 0) && (errno == EINTR));
+  assert(ret >= 0);
+  ring->queued -= ret;
+
+  // Handlers might queue new requests, so we take everything off the ring first
+  std::vector<std::pair<IoRequest*, int32_t>> completions;
+  unsigned int head = *ring->cq_head;
+  unsigned int tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  for(; head != tail; head++) {
+    struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+    completions.push_back({ (IoRequest*)(uintptr_t)cqe->user_data, cqe->res });
+  }
+  __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+  for(auto& completion : completions) {
+    completeRequest(ring, completion.first, completion.second);
+  }
+}
+
+void ioring_drain(IoRing* ring) {
+  while(ring->in_flight > 0) {
+    ioring_wait(ring);
+  }
+}
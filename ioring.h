@@ -0,0 +1,44 @@
+// Copyright (C) 2018 Jannik Vogel
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+
+#include <sys/types.h>
+
+// Minimal io_uring wrapper (raw syscalls, so we don't depend on liburing)
+
+// Default number of requests in flight
+#define IORING_DEFAULT_QUEUE_DEPTH 32
+
+// Size of each registered buffer
+#define IORING_BUFFER_SIZE (1024 * 1024)
+
+// Receives the number of bytes transferred, or a negative errno
+using IoRingCb = std::function<void(ssize_t result)>;
+
+struct IoRing;
+
+// Creates a ring with `queue_depth` entries and as many registered buffers; NULL if unsupported
+IoRing* ioring_create(unsigned int queue_depth);
+void ioring_free(IoRing* ring);
+
+// Buffers are reference counted; a new buffer starts with one reference.
+// Returns -1 if all buffers are in use, in which case ioring_wait() should be used.
+int ioring_try_acquire_buffer(IoRing* ring);
+void ioring_release_buffer(IoRing* ring, int buffer);
+uint8_t* ioring_buffer_data(IoRing* ring, int buffer);
+size_t ioring_buffer_size(IoRing* ring);
+
+// Queue a transfer. If data is within a registered buffer, that buffer is kept
+// alive until the transfer completes. Short transfers are continued internally.
+void ioring_read(IoRing* ring, int fd, void* data, size_t length, off_t offset, IoRingCb cb);
+void ioring_write(IoRing* ring, int fd, const void* data, size_t length, off_t offset, IoRingCb cb);
+
+// Submits queued requests and processes at least one completion
+void ioring_wait(IoRing* ring);
+
+// Processes completions until nothing is in flight anymore
+void ioring_drain(IoRing* ring);
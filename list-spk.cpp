@@ -0,0 +1,187 @@
+// Copyright (C) 2018 Jannik Vogel
+
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cinttypes>
+#include <string>
+
+#include <getopt.h>
+
+#include "spk.h"
+#include "spk-index.h"
+
+static bool ndjson = false;
+static bool by_offset = false;
+
+static std::string jsonString(const char* s, size_t length) {
+  std::string out = "\"";
+  for(size_t i = 0; i < length; i++) {
+    unsigned char c = s[i];
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (c < 0x20) {
+      char escape[8];
+      sprintf(escape, "\\u%04x", c);
+      out += escape;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+static std::string jsonString(const char* s) {
+  return jsonString(s, strlen(s));
+}
+
+static void listFile(const SpkIndex* index, const SpkPackage* package, size_t entry) {
+  std::string path = spk_index_path(index, entry);
+  uint64_t size = spk_index_size(index, entry);
+  uint64_t sdat_offset = spk_index_sdat_offset(index, entry);
+  off_t offset = spk_index_offset(index, entry);
+  unsigned int mode = spk_index_mode(index, entry);
+  const SpkChecksums* checksums = spk_index_checksums(index, entry);
+  std::string md5 = spk_hex(checksums->md5, sizeof(checksums->md5));
+  std::string hmac = spk_hex(checksums->hmac, sizeof(checksums->hmac));
+
+  if (ndjson) {
+    printf("{\"record\":\"file\",\"package\":%s,\"path\":%s,\"size\":%" PRIu64 ",\"mode\":\"%o\",\"sdat_offset\":%" PRIu64 ",\"offset\":%lld,\"md5\":\"%s\",\"hmac\":\"%s\"}\n",
+           jsonString(package->name).c_str(), jsonString(path.c_str()).c_str(), size, mode,
+           sdat_offset, (long long)offset, md5.c_str(), hmac.c_str());
+  } else {
+    printf("  %06o %12" PRIu64 " 0x%012llX %s %s %s\n",
+           mode, size, (long long)offset, md5.c_str(), hmac.c_str(), path.c_str());
+  }
+}
+
+static void listPackage(const SpkIndex* index, const SpkPackage* package, unsigned int package_index) {
+  size_t shortnameLength = strnlen(package->shortname, 3);
+  std::string type = spk_package_type_name(package);
+
+  size_t first;
+  size_t last;
+  spk_index_package_range(index, package_index, &first, &last);
+  unsigned int file_count = last - first;
+
+  if (ndjson) {
+    printf("{\"record\":\"package\",\"package\":%s,\"shortname\":%s,\"type\":\"%s\",\"version\":[%d,%d,%d],\"files\":%u,\"strs\":%lld,\"sdat\":%lld}\n",
+           jsonString(package->name).c_str(), jsonString(package->shortname, shortnameLength).c_str(), type.c_str(),
+           package->version.major, package->version.minor, package->version.patch, file_count,
+           (long long)package->strs, (long long)package->sdat);
+  } else {
+    printf("%s %d.%d.%d (%s, shortname '%.*s', %u files)\n",
+           package->name, package->version.major, package->version.minor, package->version.patch,
+           type.c_str(), (int)shortnameLength, package->shortname, file_count);
+  }
+
+  const uint32_t* order = by_offset ? spk_index_by_offset(index) : NULL;
+  for(size_t i = first; i < last; i++) {
+    listFile(index, package, (order != NULL) ? order[i] : i);
+  }
+}
+
+// Paths are "<package folder>/<path>", like the output of extract-spk
+static bool lookupPath(const Spk* spk, const SpkIndex* index, const char* path) {
+  const char* slash = strchr(path, '/');
+  if (slash != NULL) {
+    std::string foldername(path, slash);
+    for(unsigned int i = 0; i < spk->package_count; i++) {
+      const SpkPackage* package = &spk->packages[i];
+      if (spk_package_foldername(package) != foldername) {
+        continue;
+      }
+      long entry = spk_index_find(index, i, &slash[1]);
+      if (entry >= 0) {
+        listFile(index, package, entry);
+        return true;
+      }
+    }
+  }
+  fprintf(stderr, "No file '%s'\n", path);
+  return false;
+}
+
+static void show_help(const char* progname) {
+  printf("usage: %s [options] <example.spk> [path...]\n\n", progname);
+  printf("    --ndjson               print one JSON object per package / file\n");
+  printf("    --by-offset            list the files of each package in the order of their data\n");
+  printf("\n");
+  printf("Only the index is read; file data is never touched.\n");
+  printf("If paths (like 'game-1_02_0/config/game.json') are given, only these files are listed.\n");
+}
+
+int main(int argc, char* argv[]) {
+
+  static const struct option long_options[] = {
+    { "ndjson", no_argument, NULL, 'j' },
+    { "by-offset", no_argument, NULL, 'o' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  int c;
+  while((c = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+    switch(c) {
+      case 'j': ndjson = true; break;
+      case 'o': by_offset = true; break;
+      case 'h':
+        show_help(argv[0]);
+        return 0;
+      default:
+        show_help(argv[0]);
+        return 1;
+    }
+  }
+
+  if (optind >= argc) {
+    printf("Please provide an spk-path using `%s example.spk`\n", argv[0]);
+    return 1;
+  }
+  char* path = argv[optind];
+
+  FILE* f = fopen(path, "rb");
+  if (f == NULL) {
+    fprintf(stderr, "Unable to open '%s'\n", path);
+    return 1;
+  }
+
+  SpkIndex* index = spk_index_create(f);
+  if (index == NULL) {
+    fprintf(stderr, "Unable to parse SPK\n");
+    return 1;
+  }
+  const Spk* spk = spk_index_spk(index);
+
+  if (optind + 1 < argc) {
+    int status = 0;
+    for(int i = optind + 1; i < argc; i++) {
+      if (!lookupPath(spk, index, argv[i])) {
+        status = 1;
+      }
+    }
+    spk_index_free(index);
+    fclose(f);
+    return status;
+  }
+
+  // The leading installer (if any) is everything before SPKS
+  if (spk->offset > 0) {
+    if (ndjson) {
+      printf("{\"record\":\"header\",\"size\":%lld}\n", (long long)spk->offset);
+    } else {
+      printf("header.tar.gz (%lld bytes)\n", (long long)spk->offset);
+    }
+  }
+
+  for(unsigned int i = 0; i < spk->package_count; i++) {
+    listPackage(index, &spk->packages[i], i);
+  }
+
+  spk_index_free(index);
+  fclose(f);
+
+  return 0;
+}
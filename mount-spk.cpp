@@ -10,10 +10,17 @@
 #include <cassert>
 
 #include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
 
 #include <fcntl.h>
 
 #include "spk.h"
+#include "sparse.h"
+#ifdef HAVE_ZLIB
+#include "targz.h"
+#endif
 
 #define PATH_MAX 2048
 
@@ -74,6 +81,7 @@ static File* findFile(Folder* folder, const char* path) {
  */
 static struct options {
   const char* path;
+  int browse_header;
   int show_help;
 } options;
 
@@ -81,6 +89,7 @@ static struct options {
     { t, offsetof(struct options, p), 1 }
 static const struct fuse_opt option_spec[] = {
   OPTION("--path=%s", path),
+  OPTION("--browse-header", browse_header),
   OPTION("-h", show_help),
   OPTION("--help", show_help),
   FUSE_OPT_END
@@ -194,7 +203,9 @@ static int spk_fuse_read(const char *path, char *buf, size_t size, off_t offset,
     if ((offset + size) > file->size) {
       size = file->size - offset;
     }
-    file->read(buf, offset, size);
+    if (!file->read(buf, offset, size)) {
+      return -EIO;
+    }
   } else {
     size = 0;
   }
@@ -202,16 +213,159 @@ static int spk_fuse_read(const char *path, char *buf, size_t size, off_t offset,
   return size;
 }
 
+// lseek was only added to fuse_operations in libfuse 3.8
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(3, 8)
+#define HAVE_FUSE_LSEEK
+
+// Zero blocks are only searched for where a SEEK_DATA / SEEK_HOLE looks, one region at a time
+#define ZERO_MAP_REGION_SIZE (1024 * 1024)
+
+struct ZeroMap {
+  std::vector<bool> scanned; // Per region
+  std::vector<bool> zero; // Per SPARSE_BLOCK_SIZE block
+};
+
+static std::map<const File*, ZeroMap> zero_maps;
+
+static bool isZeroBlock(File* file, size_t block) {
+  ZeroMap& map = zero_maps[file];
+  if (map.zero.empty()) {
+    map.zero.resize((file->size + SPARSE_BLOCK_SIZE - 1) / SPARSE_BLOCK_SIZE);
+    map.scanned.resize((file->size + ZERO_MAP_REGION_SIZE - 1) / ZERO_MAP_REGION_SIZE);
+  }
+
+  size_t region = (block * SPARSE_BLOCK_SIZE) / ZERO_MAP_REGION_SIZE;
+  if (!map.scanned[region]) {
+    off_t start = (off_t)region * ZERO_MAP_REGION_SIZE;
+    size_t length = std::min((off_t)ZERO_MAP_REGION_SIZE, (off_t)file->size - start);
+    std::vector<uint8_t> buffer(length);
+    if (!file->read(buffer.data(), start, length)) {
+      // Report data, which is always correct; the region is scanned again next time
+      return false;
+    }
+    for(size_t offset = 0; offset < length; offset += SPARSE_BLOCK_SIZE) {
+      size_t block_length = std::min((size_t)SPARSE_BLOCK_SIZE, length - offset);
+      map.zero[(start + offset) / SPARSE_BLOCK_SIZE] = sparse_is_zero(&buffer[offset], block_length);
+    }
+    map.scanned[region] = true;
+  }
+
+  return map.zero[block];
+}
+
+static off_t spk_fuse_lseek(const char *path, off_t offset, int whence, struct fuse_file_info *fi) {
+  File* file = findFile(root_folder, &path[1]);
+
+  if (file == NULL) {
+    return -ENOENT;
+  }
+
+  // The kernel handles everything else itself
+  if (whence != SEEK_DATA && whence != SEEK_HOLE) {
+    return -EINVAL;
+  }
+
+  if (offset < 0 || offset >= (off_t)file->size) {
+    return -ENXIO;
+  }
+
+  size_t block_count = (file->size + SPARSE_BLOCK_SIZE - 1) / SPARSE_BLOCK_SIZE;
+  for(size_t block = offset / SPARSE_BLOCK_SIZE; block < block_count; block++) {
+    if (isZeroBlock(file, block) == (whence == SEEK_HOLE)) {
+      return std::max(offset, (off_t)(block * SPARSE_BLOCK_SIZE));
+    }
+  }
+
+  // There's always a hole at the end of a file
+  return (whence == SEEK_DATA) ? -ENXIO : file->size;
+}
+#endif
+
+// Values straight from the index, so other tools don't have to hash the data
+static std::vector<std::pair<std::string, std::string>> getAttributes(const File* file) {
+  std::vector<std::pair<std::string, std::string>> attributes;
+  if (file->spk_file == NULL) {
+    return attributes;
+  }
+
+  const SpkPackage* package = file->package;
+  const SpkFile* spk_file = file->spk_file;
+  char version[16];
+  sprintf(version, "%d.%d.%d", package->version.major, package->version.minor, package->version.patch);
+  attributes.push_back({ "user.spk.md5", spk_hex(spk_file->checksum2, sizeof(spk_file->checksum2)) });
+  attributes.push_back({ "user.spk.hmac", spk_hex(spk_file->checksum, sizeof(spk_file->checksum)) });
+  attributes.push_back({ "user.spk.sdat_offset", std::to_string(spk_file->sdat_offset) });
+  attributes.push_back({ "user.spk.package", package->name });
+  attributes.push_back({ "user.spk.version", version });
+  return attributes;
+}
+
+static int spk_fuse_getxattr(const char *path, const char *name, char *value, size_t size) {
+  File* file = findFile(root_folder, &path[1]);
+
+  if (file == NULL) {
+    return -ENODATA;
+  }
+
+  for(const auto& attribute : getAttributes(file)) {
+    if (attribute.first == name) {
+      size_t length = attribute.second.length();
+      if (size == 0) {
+        return length;
+      }
+      if (size < length) {
+        return -ERANGE;
+      }
+      memcpy(value, attribute.second.data(), length);
+      return length;
+    }
+  }
+
+  return -ENODATA;
+}
+
+static int spk_fuse_listxattr(const char *path, char *list, size_t size) {
+  File* file = findFile(root_folder, &path[1]);
+
+  std::string names;
+  if (file != NULL) {
+    for(const auto& attribute : getAttributes(file)) {
+      names += attribute.first;
+      names += '\0';
+    }
+  }
+
+  if (size == 0) {
+    return names.length();
+  }
+  if (size < names.length()) {
+    return -ERANGE;
+  }
+  memcpy(list, names.data(), names.length());
+  return names.length();
+}
+
 static struct fuse_operations spk_fuse_oper = {
   .getattr = spk_fuse_getattr,
   .open    = spk_fuse_open,
   .read    = spk_fuse_read,
+  .getxattr = spk_fuse_getxattr,
+  .listxattr = spk_fuse_listxattr,
   .readdir = spk_fuse_readdir,
   .init    = spk_fuse_init,
+#ifdef HAVE_FUSE_LSEEK
+  .lseek   = spk_fuse_lseek,
+#endif
 };
 
 static void show_help(const char *progname) {
   printf("usage: %s [options] <mountpoint>\n\n", progname);
+  printf("File-system specific options:\n"
+         "    --path=<s>             SPK file to mount\n"
+#ifdef HAVE_ZLIB
+         "    --browse-header        expose the members of header.tar.gz in 'header/'\n"
+#endif
+         "\n");
 }
 
 int main(int argc, char *argv[]) {
@@ -229,7 +383,9 @@ int main(int argc, char *argv[]) {
      string) */
   if (options.show_help) {
     show_help(argv[0]);
-    assert(fuse_opt_add_arg(&args, "--help") == 0);
+    if (fuse_opt_add_arg(&args, "--help") != 0) {
+      return 1;
+    }
     args.argv[0] = (char*) "";
   } else {
     if (options.path == NULL) {
@@ -250,12 +406,23 @@ int main(int argc, char *argv[]) {
     }
 
     root_folder = splitSpkIntoFoldersFromFILE(spk, f);
+#ifdef HAVE_ZLIB
+    if (options.browse_header) {
+      Folder* header_folder = splitHeaderIntoFoldersFromFILE(spk, f);
+      if (header_folder != NULL) {
+        addFolderToFolder(root_folder, header_folder);
+      }
+    }
+#endif
 
     printf("Mounting..\n");
   }
 
   // Force single-thread to avoid seeking while still reading in callback
-  assert(fuse_opt_add_arg(&args, "-s") == 0);
+  if (fuse_opt_add_arg(&args, "-s") != 0) {
+    printf("Unable to force single-thread mode\n");
+    return 1;
+  }
 
   return fuse_main(args.argc, args.argv, &spk_fuse_oper, NULL);
 }
@@ -0,0 +1,170 @@
+// Copyright (C) 2018 Jannik Vogel
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "pool.h"
+
+class Pool {
+public:
+  Pool() {
+    unsigned int thread_count = std::max(1u, std::thread::hardware_concurrency()) - 1;
+    for(unsigned int i = 0; i < thread_count; i++) {
+      threads.emplace_back([this]() { run(); });
+    }
+  }
+
+  ~Pool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for(std::thread& thread : threads) {
+      thread.join();
+    }
+  }
+
+  unsigned int size() {
+    return threads.size();
+  }
+
+  void submit(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+  }
+
+private:
+  void run() {
+    while(true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this]() { return stopping || !tasks.empty(); });
+        if (tasks.empty()) {
+          return;
+        }
+        task = std::move(tasks.front());
+        tasks.pop_front();
+      }
+      task();
+    }
+  }
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::deque<std::function<void()>> tasks;
+  std::vector<std::thread> threads;
+  bool stopping = false;
+};
+
+static Pool& getPool() {
+  static Pool pool;
+  return pool;
+}
+
+unsigned int pool_size() {
+  return getPool().size() + 1;
+}
+
+// Shared with the helpers, which might only start after the caller has returned
+struct Job {
+  std::function<void(unsigned int)> work;
+  unsigned int count;
+  std::atomic<unsigned int> next{0};
+  unsigned int done = 0;
+  std::mutex mutex;
+  std::condition_variable finished;
+
+  void run() {
+    unsigned int index;
+    while((index = next++) < count) {
+      work(index);
+      std::lock_guard<std::mutex> lock(mutex);
+      if (++done == count) {
+        finished.notify_all();
+      }
+    }
+  }
+};
+
+void parallelFor(unsigned int count, std::function<void(unsigned int)> work) {
+  Pool& pool = getPool();
+  unsigned int helpers = std::min(count, pool.size() + 1) - 1;
+  if (count == 0 || helpers == 0) {
+    for(unsigned int i = 0; i < count; i++) {
+      work(i);
+    }
+    return;
+  }
+
+  std::shared_ptr<Job> job = std::make_shared<Job>();
+  job->work = std::move(work);
+  job->count = count;
+  for(unsigned int i = 0; i < helpers; i++) {
+    pool.submit([job]() { job->run(); });
+  }
+
+  job->run();
+
+  std::unique_lock<std::mutex> lock(job->mutex);
+  job->finished.wait(lock, [&]() { return job->done == count; });
+}
+
+static unsigned int max_io = 0;
+static std::mutex io_mutex;
+static std::condition_variable io_available;
+static unsigned int io_in_flight = 0;
+
+void pool_set_max_io(unsigned int value) {
+  max_io = value;
+}
+
+void pool_acquire_io() {
+  if (max_io == 0) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(io_mutex);
+  io_available.wait(lock, []() { return io_in_flight < max_io; });
+  io_in_flight++;
+}
+
+bool pool_try_acquire_io() {
+  if (max_io == 0) {
+    return true;
+  }
+  std::lock_guard<std::mutex> lock(io_mutex);
+  if (io_in_flight >= max_io) {
+    return false;
+  }
+  io_in_flight++;
+  return true;
+}
+
+void pool_release_io() {
+  if (max_io == 0) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(io_mutex);
+    io_in_flight--;
+  }
+  io_available.notify_one();
+}
+
+IoSlot::IoSlot() {
+  pool_acquire_io();
+}
+
+IoSlot::~IoSlot() {
+  pool_release_io();
+}
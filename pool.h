@@ -0,0 +1,28 @@
+// Copyright (C) 2018 Jannik Vogel
+
+#pragma once
+
+#include <functional>
+
+// Worker threads shared by everything in the process; they are started on first use.
+// There is one worker less than there are cores, as the calling thread helps out.
+unsigned int pool_size();
+
+// Runs work(i) for every i in [0, count) and returns once all of them are done.
+// The caller works on items itself, so this may be nested (like parsing packages
+// of an archive which is itself processed by the pool) without deadlocking.
+void parallelFor(unsigned int count, std::function<void(unsigned int)> work);
+
+// Limit for reads / writes in flight across the process (0 is unlimited)
+void pool_set_max_io(unsigned int max_io);
+
+// One slot is needed for every read / write in flight
+void pool_acquire_io();
+bool pool_try_acquire_io(); // Returns false instead of waiting
+void pool_release_io();
+
+// Held for the duration of one blocking read or write
+struct IoSlot {
+  IoSlot();
+  ~IoSlot();
+};
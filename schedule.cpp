@@ -0,0 +1,252 @@
+// Copyright (C) 2018 Jannik Vogel
+
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <vector>
+#include <algorithm>
+#include <deque>
+
+#include "schedule.h"
+
+static off_t fileEnd(const File* file) {
+  return file->offset + file->size;
+}
+
+// Hands the parts of order[first..last) which are within the chunk at position to cb
+static void dispatchChunk(File** files, const std::vector<unsigned int>& order, size_t first, size_t last, off_t position, const uint8_t* chunk, size_t length, ScheduleCb& cb) {
+  off_t chunkEnd = position + length;
+  for(size_t i = first; i < last; i++) {
+    File* file = files[order[i]];
+    if (file->offset >= chunkEnd) {
+      break;
+    }
+    off_t low = std::max(file->offset, position);
+    off_t high = std::min(fileEnd(file), chunkEnd);
+    if (low < high) {
+      cb(order[i], &chunk[low - position], low - file->offset, high - low);
+    }
+  }
+}
+
+// Files may overlap, so we can only drop the ones at the front once a chunk is done
+static size_t advanceFirst(File** files, const std::vector<unsigned int>& order, size_t first, size_t last, off_t chunkEnd) {
+  while(first < last && fileEnd(files[order[first]]) <= chunkEnd) {
+    first++;
+  }
+  return first;
+}
+
+struct Run {
+  size_t first;
+  size_t last;
+  off_t start;
+  off_t end;
+};
+
+// Sorts files by offset and merges the ones which are adjacent (or close enough) into runs.
+// Files which aren't backed by the archive are left at the end of order, after all runs.
+static std::vector<Run> buildRuns(File** files, unsigned int file_count, std::vector<unsigned int>& order, ScheduleCb& cb) {
+  for(unsigned int i = 0; i < file_count; i++) {
+    // Empty files need no I/O
+    if (files[i]->size == 0) {
+      cb(i, NULL, 0, 0);
+      continue;
+    }
+    order.push_back(i);
+  }
+
+  std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+    const File* fileA = files[a];
+    const File* fileB = files[b];
+    if ((fileA->offset < 0) != (fileB->offset < 0)) {
+      return fileB->offset < 0;
+    }
+    return fileA->offset < fileB->offset;
+  });
+
+  std::vector<Run> runs;
+  size_t i = 0;
+  while(i < order.size() && files[order[i]]->offset >= 0) {
+    Run run;
+    run.first = i;
+    run.start = files[order[i]]->offset;
+    run.end = fileEnd(files[order[i]]);
+    run.last = i + 1;
+    while(run.last < order.size()) {
+      File* file = files[order[run.last]];
+      if (file->offset < 0 || file->offset > run.end + SCHEDULE_MAX_GAP) {
+        break;
+      }
+      run.end = std::max(run.end, fileEnd(file));
+      run.last++;
+    }
+    runs.push_back(run);
+    i = run.last;
+  }
+
+  return runs;
+}
+
+static void chunkCompleted(ScheduleChunkDoneCb& chunkDone) {
+  if (chunkDone) {
+    chunkDone();
+  }
+}
+
+static bool readUnbackedFiles(File** files, const std::vector<unsigned int>& order, size_t first, uint8_t* chunk, size_t chunk_size, ScheduleCb& cb, ScheduleChunkDoneCb& chunkDone) {
+  for(size_t i = first; i < order.size(); i++) {
+    File* file = files[order[i]];
+    for(off_t offset = 0; offset < (off_t)file->size;) {
+      size_t length = std::min((off_t)chunk_size, (off_t)file->size - offset);
+      if (!file->read(chunk, offset, length)) {
+        printf("Unable to read '%s'\n", file->name);
+        return false;
+      }
+      cb(order[i], chunk, offset, length);
+      chunkCompleted(chunkDone);
+      offset += length;
+    }
+  }
+  return true;
+}
+
+bool scheduleReads(File** files, unsigned int file_count, FileReadCb rawRead, ScheduleCb cb, ScheduleChunkDoneCb chunkDone) {
+  std::vector<unsigned int> order;
+  std::vector<Run> runs = buildRuns(files, file_count, order, cb);
+
+  uint8_t* chunk = (uint8_t*)malloc(SCHEDULE_CHUNK_SIZE);
+
+  size_t unbacked = 0;
+  for(const Run& run : runs) {
+    size_t first = run.first;
+    for(off_t position = run.start; position < run.end;) {
+      size_t length = std::min((off_t)SCHEDULE_CHUNK_SIZE, run.end - position);
+      if (!rawRead(chunk, position, length)) {
+        printf("Unable to read archive at 0x%llX\n", (long long)position);
+        free(chunk);
+        return false;
+      }
+      dispatchChunk(files, order, first, run.last, position, chunk, length, cb);
+      chunkCompleted(chunkDone);
+      position += length;
+      first = advanceFirst(files, order, first, run.last, position);
+    }
+    unbacked = run.last;
+  }
+
+  bool ok = readUnbackedFiles(files, order, unbacked, chunk, SCHEDULE_CHUNK_SIZE, cb, chunkDone);
+
+  free(chunk);
+  return ok;
+}
+
+#ifdef HAVE_IO_URING
+struct PendingChunk {
+  int buffer;
+  off_t position;
+  size_t length;
+  size_t first;
+  size_t last;
+  bool done;
+  ssize_t result;
+};
+
+bool scheduleReadsAsync(File** files, unsigned int file_count, IoRing* ring, int fd, ScheduleCb cb, ScheduleChunkDoneCb chunkDone) {
+  std::vector<unsigned int> order;
+  std::vector<Run> runs = buildRuns(files, file_count, order, cb);
+
+  // Reads complete in any order, but chunks are handed out in archive order
+  std::deque<PendingChunk*> pending;
+  bool failed = false;
+  auto dispatchCompleted = [&]() {
+    while(!pending.empty() && pending.front()->done) {
+      PendingChunk* chunk = pending.front();
+      pending.pop_front();
+      // Once a chunk is missing, the data of later chunks would be incomplete
+      if (!failed && chunk->result < 0) {
+        printf("Unable to read archive at 0x%llX (%s)\n", (long long)chunk->position, strerror(-chunk->result));
+        failed = true;
+      } else if (!failed && chunk->result != (ssize_t)chunk->length) {
+        printf("Archive ends early at 0x%llX\n", (long long)(chunk->position + chunk->result));
+        failed = true;
+      }
+      if (failed) {
+        ioring_release_buffer(ring, chunk->buffer);
+        delete chunk;
+        continue;
+      }
+      dispatchChunk(files, order, chunk->first, chunk->last, chunk->position, ioring_buffer_data(ring, chunk->buffer), chunk->length, cb);
+      chunkCompleted(chunkDone);
+      ioring_release_buffer(ring, chunk->buffer);
+      delete chunk;
+    }
+  };
+  auto acquireBuffer = [&]() {
+    int buffer = ioring_try_acquire_buffer(ring);
+    while(buffer < 0) {
+      dispatchCompleted();
+      buffer = ioring_try_acquire_buffer(ring);
+      if (buffer < 0) {
+        ioring_wait(ring);
+      }
+    }
+    return buffer;
+  };
+
+  size_t chunk_size = ioring_buffer_size(ring);
+  size_t unbacked = 0;
+  for(const Run& run : runs) {
+    size_t first = run.first;
+    for(off_t position = run.start; (position < run.end) && !failed;) {
+      PendingChunk* chunk = new PendingChunk();
+      chunk->buffer = acquireBuffer();
+      chunk->position = position;
+      chunk->length = std::min((off_t)chunk_size, run.end - position);
+      chunk->first = first;
+      chunk->last = run.last;
+      chunk->done = false;
+      pending.push_back(chunk);
+      ioring_read(ring, fd, ioring_buffer_data(ring, chunk->buffer), chunk->length, position, [=](ssize_t result) {
+        chunk->result = result;
+        chunk->done = true;
+      });
+      position += chunk->length;
+      first = advanceFirst(files, order, first, run.last, position);
+    }
+    unbacked = run.last;
+  }
+
+  dispatchCompleted();
+  while(!pending.empty()) {
+    ioring_wait(ring);
+    dispatchCompleted();
+  }
+  if (failed) {
+    return false;
+  }
+
+  // Every chunk gets its own buffer, as cb might still be writing from the previous one
+  for(size_t i = unbacked; i < order.size(); i++) {
+    File* file = files[order[i]];
+    for(off_t offset = 0; offset < (off_t)file->size;) {
+      size_t length = std::min((off_t)chunk_size, (off_t)file->size - offset);
+      int buffer = acquireBuffer();
+      uint8_t* chunk = ioring_buffer_data(ring, buffer);
+      if (!file->read(chunk, offset, length)) {
+        printf("Unable to read '%s'\n", file->name);
+        ioring_release_buffer(ring, buffer);
+        return false;
+      }
+      cb(order[i], chunk, offset, length);
+      chunkCompleted(chunkDone);
+      ioring_release_buffer(ring, buffer);
+      offset += length;
+    }
+  }
+
+  return true;
+}
+#endif
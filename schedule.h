@@ -0,0 +1,35 @@
+// Copyright (C) 2018 Jannik Vogel
+
+#pragma once
+
+#include <functional>
+
+#include "spk.h"
+
+#ifdef HAVE_IO_URING
+#include "ioring.h"
+#endif
+
+// Reads are merged into chunks of this size
+#define SCHEDULE_CHUNK_SIZE (8 * 1024 * 1024)
+
+// Gaps up to this size between files are read through instead of seeking
+#define SCHEDULE_MAX_GAP (64 * 1024)
+
+// Receives a piece of files[index]; offset is relative to the start of that file.
+// Every file gets at least one call and the last call for a file ends at file->size.
+using ScheduleCb = std::function<void(unsigned int index, const void* data, off_t offset, size_t length)>;
+
+// Called once all pieces of a chunk have been handed out, before its buffer is reused
+using ScheduleChunkDoneCb = std::function<void()>;
+
+// Reads all files in ascending archive offset, using rawRead for large contiguous reads.
+// Files which aren't backed by the archive are read through their own read callback last.
+// Returns false if a read failed or the archive ended early; no further data is handed out then.
+bool scheduleReads(File** files, unsigned int file_count, FileReadCb rawRead, ScheduleCb cb, ScheduleChunkDoneCb chunkDone = nullptr);
+
+#ifdef HAVE_IO_URING
+// Same as scheduleReads, but keeps many reads of fd in flight using the registered buffers of ring.
+// cb may queue writes of the data it receives on ring; the buffer stays alive until they complete.
+bool scheduleReadsAsync(File** files, unsigned int file_count, IoRing* ring, int fd, ScheduleCb cb, ScheduleChunkDoneCb chunkDone = nullptr);
+#endif
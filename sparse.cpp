@@ -0,0 +1,59 @@
+// Copyright (C) 2018 Jannik Vogel
+
+#include <cstring>
+#include <algorithm>
+
+#include "sparse.h"
+
+// Generic vectors; the compiler picks the widest registers it may use
+typedef uint64_t v8u64 __attribute__((vector_size(64)));
+
+bool sparse_is_zero(const void* data, size_t length) {
+  const uint8_t* p = (const uint8_t*)data;
+
+  // Most data isn't zero, so check every 256 bytes to bail out early
+  while(length >= 4 * sizeof(v8u64)) {
+    v8u64 v[4];
+    memcpy(v, p, sizeof(v));
+    v8u64 any = v[0] | v[1] | v[2] | v[3];
+    uint64_t lanes = 0;
+    for(unsigned int i = 0; i < 8; i++) {
+      lanes |= any[i];
+    }
+    if (lanes != 0) {
+      return false;
+    }
+    p += sizeof(v);
+    length -= sizeof(v);
+  }
+
+  uint8_t any = 0;
+  for(size_t i = 0; i < length; i++) {
+    any |= p[i];
+  }
+  return any == 0;
+}
+
+void sparse_split(const void* data, off_t offset, size_t length, std::function<void(const void* data, off_t offset, size_t length)> cb) {
+  const uint8_t* p = (const uint8_t*)data;
+  off_t end = offset + length;
+
+  off_t run = offset; // Start of data which hasn't been handed out yet
+  for(off_t position = offset; position < end;) {
+    off_t block_end = std::min((position / SPARSE_BLOCK_SIZE + 1) * SPARSE_BLOCK_SIZE, end);
+
+    // Partial blocks are always written, so they never become a hole
+    bool partial = (position % SPARSE_BLOCK_SIZE != 0) || (block_end % SPARSE_BLOCK_SIZE != 0);
+    if (!partial && sparse_is_zero(&p[position - offset], block_end - position)) {
+      if (run < position) {
+        cb(&p[run - offset], run, position - run);
+      }
+      run = block_end;
+    }
+    position = block_end;
+  }
+
+  if (run < end) {
+    cb(&p[run - offset], run, end - run);
+  }
+}
@@ -0,0 +1,18 @@
+// Copyright (C) 2018 Jannik Vogel
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include <sys/types.h>
+
+// Zero runs are only detected in whole blocks of this size (aligned to the file offset)
+#define SPARSE_BLOCK_SIZE 4096
+
+// True if all bytes are zero
+bool sparse_is_zero(const void* data, size_t length);
+
+// Calls cb for every run of data which isn't an all-zero block; offset is where data is in the file
+void sparse_split(const void* data, off_t offset, size_t length, std::function<void(const void* data, off_t offset, size_t length)> cb);
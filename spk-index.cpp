@@ -0,0 +1,306 @@
+// Copyright (C) 2018 Jannik Vogel
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "spk-index.h"
+
+// Integers which are stored as 32-bit until a value needs 64 bits
+class IntColumn {
+public:
+  void push_back(uint64_t value) {
+    if (wide.empty() && value <= UINT32_MAX) {
+      narrow.push_back(value);
+      return;
+    }
+    if (wide.empty()) {
+      wide.assign(narrow.begin(), narrow.end());
+      narrow.clear();
+      narrow.shrink_to_fit();
+    }
+    wide.push_back(value);
+  }
+
+  uint64_t operator[](size_t i) const {
+    return wide.empty() ? narrow[i] : wide[i];
+  }
+
+  void shrink_to_fit() {
+    narrow.shrink_to_fit();
+    wide.shrink_to_fit();
+  }
+
+private:
+  std::vector<uint32_t> narrow;
+  std::vector<uint64_t> wide;
+};
+
+// Columns of one package; packages are parsed in parallel, so each fills its own
+struct PackageColumns {
+  // Hot columns
+  IntColumn sizes;
+  IntColumn sdat_offsets;
+  std::vector<uint16_t> modes;
+
+  // Front-coded paths; every entry is <shared prefix length> <suffix length> <suffix>
+  std::vector<uint8_t> paths;
+  std::vector<uint32_t> buckets; // Offset in paths of the first entry of every bucket
+
+  // Cold column
+  std::vector<SpkChecksums> checksums;
+
+  void shrink_to_fit() {
+    sizes.shrink_to_fit();
+    sdat_offsets.shrink_to_fit();
+    modes.shrink_to_fit();
+    paths.shrink_to_fit();
+    buckets.shrink_to_fit();
+    checksums.shrink_to_fit();
+  }
+};
+
+struct SpkIndex {
+  Spk* spk;
+  std::vector<size_t> package_first; // One more than there are packages
+  std::vector<PackageColumns> packages;
+
+  // Orders which are only built when needed
+  mutable std::once_flag by_path_once;
+  mutable std::vector<uint32_t> by_path;
+  mutable std::once_flag by_offset_once;
+  mutable std::vector<uint32_t> by_offset;
+};
+
+static void writeVarint(std::vector<uint8_t>& out, size_t value) {
+  while(value >= 0x80) {
+    out.push_back((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  out.push_back(value);
+}
+
+static size_t readVarint(const uint8_t* data, size_t* position) {
+  size_t value = 0;
+  unsigned int shift = 0;
+  while(true) {
+    uint8_t byte = data[(*position)++];
+    value |= (size_t)(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+    shift += 7;
+  }
+}
+
+static void addPath(PackageColumns& columns, size_t entry, const char* path, size_t length, std::string& previous) {
+  size_t shared = 0;
+  if (entry % SPK_INDEX_BUCKET_SIZE == 0) {
+    columns.buckets.push_back(columns.paths.size());
+  } else {
+    size_t limit = std::min(length, previous.length());
+    while(shared < limit && previous[shared] == path[shared]) {
+      shared++;
+    }
+  }
+  writeVarint(columns.paths, shared);
+  writeVarint(columns.paths, length - shared);
+  columns.paths.insert(columns.paths.end(), &path[shared], &path[length]);
+  previous.assign(path, length);
+}
+
+// State of a package while its records arrive
+struct PackageBuilder {
+  PackageColumns columns;
+  size_t count = 0;
+  std::string previous; // Last path, for front-coding
+};
+
+SpkIndex* spk_index_create(FILE* f) {
+  std::mutex mutex;
+  std::map<unsigned int, PackageBuilder> builders;
+
+  Spk* spk = spk_parse_records(f, [&](unsigned int package_index, const SpkFile* file, const char* path, size_t path_length) {
+    // Nodes of a map stay where they are, so only finding them needs the lock
+    PackageBuilder* builder;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      builder = &builders[package_index];
+    }
+
+    PackageColumns& columns = builder->columns;
+    columns.sizes.push_back(file->size);
+    columns.sdat_offsets.push_back(file->sdat_offset);
+    columns.modes.push_back(file->permissions);
+
+    SpkChecksums checksums;
+    memcpy(checksums.md5, file->checksum2, sizeof(checksums.md5));
+    memcpy(checksums.hmac, file->checksum, sizeof(checksums.hmac));
+    columns.checksums.push_back(checksums);
+
+    addPath(columns, builder->count, path, path_length, builder->previous);
+    builder->count++;
+  });
+  if (spk == NULL) {
+    return NULL;
+  }
+
+  SpkIndex* index = new SpkIndex();
+  index->spk = spk;
+  index->packages.resize(spk->package_count);
+
+  size_t entry = 0;
+  for(unsigned int i = 0; i < spk->package_count; i++) {
+    index->package_first.push_back(entry);
+    auto it = builders.find(i);
+    if (it != builders.end()) {
+      index->packages[i] = std::move(it->second.columns);
+      index->packages[i].shrink_to_fit();
+      entry += it->second.count;
+    }
+  }
+  index->package_first.push_back(entry);
+
+  return index;
+}
+
+void spk_index_free(SpkIndex* index) {
+  spk_free(index->spk);
+  delete index;
+}
+
+const Spk* spk_index_spk(const SpkIndex* index) {
+  return index->spk;
+}
+
+size_t spk_index_count(const SpkIndex* index) {
+  return index->package_first.back();
+}
+
+void spk_index_package_range(const SpkIndex* index, unsigned int package, size_t* first, size_t* last) {
+  *first = index->package_first[package];
+  *last = index->package_first[package + 1];
+}
+
+unsigned int spk_index_package(const SpkIndex* index, size_t entry) {
+  auto it = std::upper_bound(index->package_first.begin(), index->package_first.end(), entry);
+  return (it - index->package_first.begin()) - 1;
+}
+
+// Columns of the package of entry; *local is the position within them
+static const PackageColumns& getColumns(const SpkIndex* index, size_t entry, size_t* local) {
+  unsigned int package = spk_index_package(index, entry);
+  *local = entry - index->package_first[package];
+  return index->packages[package];
+}
+
+uint64_t spk_index_size(const SpkIndex* index, size_t entry) {
+  size_t local;
+  return getColumns(index, entry, &local).sizes[local];
+}
+
+uint64_t spk_index_sdat_offset(const SpkIndex* index, size_t entry) {
+  size_t local;
+  return getColumns(index, entry, &local).sdat_offsets[local];
+}
+
+off_t spk_index_offset(const SpkIndex* index, size_t entry) {
+  const SpkPackage* package = &index->spk->packages[spk_index_package(index, entry)];
+  return package->sdat + spk_index_sdat_offset(index, entry);
+}
+
+uint16_t spk_index_mode(const SpkIndex* index, size_t entry) {
+  size_t local;
+  return getColumns(index, entry, &local).modes[local];
+}
+
+const SpkChecksums* spk_index_checksums(const SpkIndex* index, size_t entry) {
+  size_t local;
+  return &getColumns(index, entry, &local).checksums[local];
+}
+
+std::string spk_index_path(const SpkIndex* index, size_t entry) {
+  size_t local;
+  const PackageColumns& columns = getColumns(index, entry, &local);
+  size_t bucket = local / SPK_INDEX_BUCKET_SIZE;
+  size_t position = columns.buckets[bucket];
+  std::string path;
+  for(size_t i = bucket * SPK_INDEX_BUCKET_SIZE; i <= local; i++) {
+    size_t shared = readVarint(columns.paths.data(), &position);
+    size_t length = readVarint(columns.paths.data(), &position);
+    path.resize(shared);
+    path.append((const char*)&columns.paths[position], length);
+    position += length;
+  }
+  return path;
+}
+
+// Entries ordered by package, then by path
+static const std::vector<uint32_t>& getByPath(const SpkIndex* index) {
+  std::call_once(index->by_path_once, [&]() {
+    size_t count = spk_index_count(index);
+
+    // Decoding once is much cheaper than decoding in every comparison
+    std::vector<std::string> paths(count);
+    for(size_t i = 0; i < count; i++) {
+      paths[i] = spk_index_path(index, i);
+    }
+
+    std::vector<uint32_t>& order = index->by_path;
+    order.resize(count);
+    for(unsigned int i = 0; i < index->spk->package_count; i++) {
+      size_t first = index->package_first[i];
+      size_t last = index->package_first[i + 1];
+      for(size_t j = first; j < last; j++) {
+        order[j] = j;
+      }
+      std::sort(order.begin() + first, order.begin() + last, [&](uint32_t a, uint32_t b) {
+        return paths[a] < paths[b];
+      });
+    }
+  });
+  return index->by_path;
+}
+
+long spk_index_find(const SpkIndex* index, unsigned int package, const std::string& path) {
+  const std::vector<uint32_t>& order = getByPath(index);
+  size_t low = index->package_first[package];
+  size_t high = index->package_first[package + 1];
+  while(low < high) {
+    size_t middle = low + (high - low) / 2;
+    int comparison = spk_index_path(index, order[middle]).compare(path);
+    if (comparison == 0) {
+      return order[middle];
+    }
+    if (comparison < 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return -1;
+}
+
+const uint32_t* spk_index_by_offset(const SpkIndex* index) {
+  std::call_once(index->by_offset_once, [&]() {
+    std::vector<uint32_t>& order = index->by_offset;
+    order.resize(spk_index_count(index));
+    for(unsigned int i = 0; i < index->spk->package_count; i++) {
+      size_t first = index->package_first[i];
+      size_t last = index->package_first[i + 1];
+      const PackageColumns& columns = index->packages[i];
+      for(size_t j = first; j < last; j++) {
+        order[j] = j;
+      }
+      std::stable_sort(order.begin() + first, order.begin() + last, [&](uint32_t a, uint32_t b) {
+        return columns.sdat_offsets[a - first] < columns.sdat_offsets[b - first];
+      });
+    }
+  });
+  return index->by_offset.data();
+}
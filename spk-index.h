@@ -0,0 +1,54 @@
+// Copyright (C) 2018 Jannik Vogel
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+#include "spk.h"
+
+// Compact, column-oriented index of the file records of all packages.
+// Entries keep the order of the FINF / FI64 records; the entries of a package
+// are contiguous. Sizes, offsets and modes are dense arrays (32-bit unless a
+// value needs more), paths are front-coded and checksums are kept apart, as
+// they are rarely needed. Records go straight from the parser into the columns,
+// so they are never stored as SpkFile.
+
+// Paths are front-coded relative to the first path of every bucket of this many entries
+#define SPK_INDEX_BUCKET_SIZE 16
+
+typedef struct SpkChecksums_ {
+  uint8_t md5[16]; // SpkFile::checksum2
+  uint8_t hmac[20]; // SpkFile::checksum
+} SpkChecksums;
+
+struct SpkIndex;
+
+// Parses the SPK in f; NULL if it can't be parsed
+SpkIndex* spk_index_create(FILE* f);
+void spk_index_free(SpkIndex* index);
+
+// Packages of the SPK; they have no file records (files is NULL and file_count is 0)
+const Spk* spk_index_spk(const SpkIndex* index);
+
+size_t spk_index_count(const SpkIndex* index);
+
+// Entries of spk->packages[package] are [*first, *last)
+void spk_index_package_range(const SpkIndex* index, unsigned int package, size_t* first, size_t* last);
+unsigned int spk_index_package(const SpkIndex* index, size_t entry);
+
+uint64_t spk_index_size(const SpkIndex* index, size_t entry);
+uint64_t spk_index_sdat_offset(const SpkIndex* index, size_t entry); // Relative to SDAT of the package
+off_t spk_index_offset(const SpkIndex* index, size_t entry); // Absolute
+uint16_t spk_index_mode(const SpkIndex* index, size_t entry);
+const SpkChecksums* spk_index_checksums(const SpkIndex* index, size_t entry);
+
+// Path relative to the package folder
+std::string spk_index_path(const SpkIndex* index, size_t entry);
+
+// Binary search for a path in a package; returns the entry or -1
+long spk_index_find(const SpkIndex* index, unsigned int package, const std::string& path);
+
+// Entries ordered by package, then by offset; built on first use
+const uint32_t* spk_index_by_offset(const SpkIndex* index);
@@ -5,13 +5,18 @@
 #include <cstdlib>
 #include <cstring>
 #include <cassert>
+#include <cerrno>
 #include <climits>
 #include <cinttypes>
 #include <string>
+#include <vector>
+#include <algorithm>
 
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "spk.h"
+#include "pool.h"
 
 static uint64_t readLength(FILE* f) {
   uint32_t length;
@@ -25,26 +30,47 @@ static uint64_t readLength(FILE* f) {
   return length;
 }
 
-static SpkPackage* indexPackage(Spk* spk) {
-  spk->packages = (SpkPackage*)realloc(spk->packages, sizeof(SpkPackage) * ++spk->package_count);
-  SpkPackage* new_package = &spk->packages[spk->package_count - 1];  
-  new_package->file_count = 0;
-  new_package->files = NULL;
-  return new_package;
+static void indexPackage(SpkPackage* package) {
+  package->file_count = 0;
+  package->files = NULL;
 }
 
-static void indexFile(SpkPackage* package, FILE* f, off_t strs, off_t sdat, size_t length, mode_t permissions, uint8_t* checksum1, uint8_t* checksum2) {
-  package->files = (SpkFile*)realloc(package->files, sizeof(SpkFile) * ++package->file_count);
-  SpkFile* new_file = &package->files[package->file_count - 1];
-    //FIXME: Create a new file
+// Where the file records of a package go; without a callback, they are added to package->files
+struct RecordSink {
+  const SpkRecordCb& cb;
+  unsigned int package_index;
+  const uint8_t* data; // Index of the package in memory, which includes STRS
+  off_t data_offset; // Offset of data in the archive
+};
+
+static void indexFile(SpkPackage* package, RecordSink& sink, off_t strs, off_t sdat, size_t length, mode_t permissions, uint8_t* checksum1, uint8_t* checksum2) {
+  SpkFile record;
+  SpkFile* new_file = &record;
+  if (!sink.cb) {
+    package->files = (SpkFile*)realloc(package->files, sizeof(SpkFile) * ++package->file_count);
+    new_file = &package->files[package->file_count - 1];
+  }
   new_file->strs_offset = strs;
   new_file->size = length;
   new_file->permissions = permissions;
   new_file->sdat_offset = sdat;
+  new_file->length2 = length;
+  memcpy(new_file->checksum, checksum1, sizeof(new_file->checksum));
+  memcpy(new_file->checksum2, checksum2, sizeof(new_file->checksum2));
+  if (sink.cb) {
+    const char* path = "";
+    size_t path_length = 0;
+    if ((size_t)strs < package->strs_size) {
+      path = (const char*)&sink.data[package->strs - sink.data_offset + strs];
+      path_length = strnlen(path, package->strs_size - strs);
+    }
+    sink.cb(sink.package_index, new_file, path, path_length);
+  }
 }
 
 
-static void readSidx(Spk* spk, FILE* f) {
+// Offsets in f are relative to base
+static void readSidx(SpkPackage* package, FILE* f, off_t base, size_t* sdatSizeOut, RecordSink& sink) {
   uint8_t magic[4];
 
   fread(magic, 4, 1, f);
@@ -59,9 +85,9 @@ static void readSidx(Spk* spk, FILE* f) {
     uint32_t sdatSize; // sdat size, or 0xFFFFFFFF if SZ64 follows?
   } __attribute__((packed)) sidx;
   fread(&sidx, sizeof(sidx), 1, f);
-  printf("Package name is '%.32s' (%d files?)\n", sidx.name, sidx.unk2);
+  fprintf(stderr, "Package name is '%.32s' (%d files?)\n", sidx.name, sidx.unk2);
 
-  SpkPackage* package = indexPackage(spk);
+  indexPackage(package);
   package->name = strndup(sidx.name, 32-3);
   memcpy(package->shortname, &sidx.name[32-3], 3);
   package->shortname[3] = 0;
@@ -89,7 +115,8 @@ static void readSidx(Spk* spk, FILE* f) {
   {
     uint32_t length;
     fread(&length, 4, 1, f);
-    package->strs = ftell(f);
+    package->strs = base + ftell(f);
+    package->strs_size = length;
     fseek(f, length, SEEK_CUR);
   }
 
@@ -116,7 +143,7 @@ static void readSidx(Spk* spk, FILE* f) {
       assert(fi64.unk0 == (sizeof(fi64) - 4));
       assert(fi64.length == fi64.length2);
 
-      indexFile(package, f, fi64.strs_offset, fi64.sdat_offset, fi64.length, fi64.permissions, fi64.checksum, fi64.checksum2);
+      indexFile(package, sink, fi64.strs_offset, fi64.sdat_offset, fi64.length, fi64.permissions, fi64.checksum, fi64.checksum2);
       
       sdatSize += fi64.length;
 
@@ -139,7 +166,7 @@ static void readSidx(Spk* spk, FILE* f) {
       assert(finf.unk0 == (sizeof(finf) - 4));
       assert(finf.length == finf.length2);
 
-      indexFile(package, f, finf.strs_offset, finf.sdat_offset, finf.length, finf.permissions, finf.checksum, finf.checksum2);
+      indexFile(package, sink, finf.strs_offset, finf.sdat_offset, finf.length, finf.permissions, finf.checksum, finf.checksum2);
 
       sdatSize += finf.length;
 
@@ -163,24 +190,23 @@ static void readSidx(Spk* spk, FILE* f) {
   assert(memcmp(magic, "SDAT", 4) == 0);
   {
     uint64_t unk = readLength(f);
-    package->sdat = ftell(f);
+    package->sdat = base + ftell(f);
   }
 
-  // Skip rest of data
-  printf("Skipping %zu\n", sdatSize);
-  fseek(f, sdatSize, SEEK_CUR);
-
-
+  // Rest of data is not part of the index
+  fprintf(stderr, "Skipping %zu\n", sdatSize);
+  *sdatSizeOut = sdatSize;
 }
 
-static void readSpk0(Spk* spk, FILE* f) {
+static void readSpk0(SpkPackage* package, FILE* f, off_t base, RecordSink& sink) {
   uint8_t magic[4];
   fread(magic, 4, 1, f);
   assert(memcmp(magic, "SPK0", 4) == 0);
   uint64_t length = readLength(f);
-  off_t next_offset = ftell(f) + length;
-  readSidx(spk, f);
-  assert(ftell(f) == next_offset);
+  off_t next_offset = base + ftell(f) + length;
+  size_t sdatSize;
+  readSidx(package, f, base, &sdatSize, sink);
+  assert(package->sdat + (off_t)sdatSize == next_offset);
 }
 
 
@@ -189,15 +215,67 @@ void readChunkHeader(FILE* f, uint8_t* magic, uint64_t* value) {
   *value = readLength(f);
 }
 
-void readSpksData(Spk* spk, FILE* f, uint64_t length) {
+struct PackageRegion {
+  off_t start; // Offset of SPK0
+  size_t index_size; // Size up to and including the SDAT header
+};
+
+// Only looks at chunk headers, so the packages can be found without decoding their index
+static std::vector<PackageRegion> scanSpksData(FILE* f) {
+  std::vector<PackageRegion> regions;
   uint32_t chunkCount;
   fread(&chunkCount, 4, 1, f);
   for(uint32_t i = 0; i < chunkCount; i++) {
-    readSpk0(spk, f);
+    uint8_t magic[4];
+    uint64_t length;
+    PackageRegion region;
+    region.start = ftell(f);
+    readChunkHeader(f, magic, &length);
+    assert(memcmp(magic, "SPK0", 4) == 0);
+    off_t next_offset = ftell(f) + length;
+    readChunkHeader(f, magic, &length);
+    assert(memcmp(magic, "SIDX", 4) == 0);
+
+    // SDAT header follows SIDX and has a 32-bit or 64-bit length
+    off_t index_end = std::min(ftell(f) + (off_t)length + 4 + 4 + 8, next_offset);
+    region.index_size = index_end - region.start;
+    regions.push_back(region);
+
+    fseek(f, next_offset, SEEK_SET);
   }
+  return regions;
 }
 
-Spk* spk_parse(FILE* f) {
+static void readPackage(SpkPackage* package, int fd, const PackageRegion& region, RecordSink& sink) {
+  uint8_t* buffer = (uint8_t*)malloc(region.index_size);
+  ssize_t length;
+  {
+    IoSlot slot;
+    length = pread(fd, buffer, region.index_size, region.start);
+  }
+  assert(length == (ssize_t)region.index_size);
+  FILE* f = fmemopen(buffer, region.index_size, "r");
+  sink.data = buffer;
+  sink.data_offset = region.start;
+  readSpk0(package, f, region.start, sink);
+  fclose(f);
+  free(buffer);
+}
+
+static void readSpksData(Spk* spk, FILE* f, uint64_t length, const SpkRecordCb& cb) {
+  std::vector<PackageRegion> regions = scanSpksData(f);
+
+  // Each package index is decoded from its own copy, so they can be done in parallel
+  spk->package_count = regions.size();
+  spk->packages = (SpkPackage*)calloc(regions.size(), sizeof(SpkPackage));
+  int fd = fileno(f);
+  parallelFor(regions.size(), [&](unsigned int i) {
+    RecordSink sink = { cb, i, NULL, 0 };
+    readPackage(&spk->packages[i], fd, regions[i], sink);
+  });
+}
+
+Spk* spk_parse_records(FILE* f, SpkRecordCb cb) {
   uint8_t magic[4];
 
   Spk* spk = (Spk*)malloc(sizeof(Spk));
@@ -208,7 +286,7 @@ Spk* spk_parse(FILE* f) {
   spk->offset = 0;
   readChunkHeader(f, magic, &value);
   if (memcmp(magic, "SPKS", 4) == 0) {
-    readSpksData(spk, f, value);
+    readSpksData(spk, f, value, cb);
   } else {
     off_t endOfSpks;
     
@@ -221,10 +299,10 @@ Spk* spk_parse(FILE* f) {
         uint32_t offset;
       } __attribute__((packed)) send;
       if (fread(&send, 1, sizeof(send), f) != sizeof(send)) {
-        printf("Incomplete SEND\n");
+        fprintf(stderr, "Incomplete SEND\n");
         assert(false);
       }
-      printf("SPKS at 0x%08" PRIX32 "\n", send.offset);
+      fprintf(stderr, "SPKS at 0x%08" PRIX32 "\n", send.offset);
       fseek(f, send.offset, SEEK_SET);
     } else {
       fseek(f, -16, SEEK_END);
@@ -236,13 +314,13 @@ Spk* spk_parse(FILE* f) {
           uint64_t offset;
         } __attribute__((packed)) se64;
         if (fread(&se64, 1, sizeof(se64), f) != sizeof(se64)) {
-          printf("Incomplete SE64\n");
+          fprintf(stderr, "Incomplete SE64\n");
           assert(false);
         }
-        printf("SPKS at 0x%016" PRIX64 "\n", se64.offset);
+        fprintf(stderr, "SPKS at 0x%016" PRIX64 "\n", se64.offset);
         fseek(f, se64.offset, SEEK_SET);
       } else {
-        printf("Unable to find SPKS, then unable to find SEND / SE64\n");
+        fprintf(stderr, "Unable to find SPKS, then unable to find SEND / SE64\n");
         return NULL;
       }
     }
@@ -250,13 +328,46 @@ Spk* spk_parse(FILE* f) {
     spk->offset = ftell(f);
     readChunkHeader(f, magic, &value);
     assert(memcmp(magic, "SPKS", 4) == 0);
-    readSpksData(spk, f, value);
+    readSpksData(spk, f, value, cb);
     assert(ftell(f) == endOfSpks);
   }
 
   return spk;
 }
 
+Spk* spk_parse(FILE* f) {
+  return spk_parse_records(f, nullptr);
+}
+
+char* spk_read_strs(FILE* f, const SpkPackage* package) {
+  char* strs = (char*)malloc(package->strs_size + 1);
+  fseek(f, package->strs, SEEK_SET);
+  size_t length = fread(strs, 1, package->strs_size, f);
+  strs[length] = '\0';
+  return strs;
+}
+
+std::string spk_package_type_name(const SpkPackage* package) {
+  switch(package->type) {
+    case 1: return "SPIKE_1";
+    case 2: return "GAME";
+    case 3: return "SPIKE_2";
+    case 4: return "SPIKE_3";
+    default:
+      return "UNKNOWN_" + std::to_string(package->type);
+  }
+}
+
+std::string spk_hex(const uint8_t* data, size_t length) {
+  static const char digits[] = "0123456789abcdef";
+  std::string s;
+  for(size_t i = 0; i < length; i++) {
+    s += digits[data[i] >> 4];
+    s += digits[data[i] & 0xF];
+  }
+  return s;
+}
+
 void spk_free(Spk* spk) {
   for(unsigned int i = 0; i < spk->package_count; i++) {
     SpkPackage* package = &spk->packages[i];
@@ -268,20 +379,23 @@ void spk_free(Spk* spk) {
 }
 
 
-static char* get_spk_package_foldername(const SpkPackage* package) {
-  static char foldername[64];
+static void get_spk_package_foldername(const SpkPackage* package, char* foldername) {
 
   if (package->type != 2) {
     sprintf(foldername, "%s-%d_%d_%d", package->name, package->version.major, package->version.minor, package->version.patch);
   } else {
     sprintf(foldername, "%s-%d_%02d_%d", package->name, package->version.major, package->version.minor, package->version.patch);
   }
-  
+}
+
+std::string spk_package_foldername(const SpkPackage* package) {
+  char foldername[64];
+  get_spk_package_foldername(package, foldername);
   return foldername;
 }
 
 
-static Folder* createFolder() {
+Folder* createFolder() {
   Folder* folder = new Folder();
   folder->name = NULL;
   folder->folder_count = 0;
@@ -342,7 +456,8 @@ Folder* addFileInPath(Folder* folder, char* path, File* file) {
 
 Folder* splitPackageIntoFolders(const SpkPackage* package, SpkReadCb strsRead, SpkReadCb sdatRead) {
 
-  char* folderName = get_spk_package_foldername(package);
+  char folderName[64];
+  get_spk_package_foldername(package, folderName);
 
   Folder* folder = createFolder();
   folder->name = strdup(folderName);
@@ -353,8 +468,11 @@ Folder* splitPackageIntoFolders(const SpkPackage* package, SpkReadCb strsRead, S
     abstractFile->name = NULL;
     abstractFile->permissions = file->permissions;
     abstractFile->size = file->size;
+    abstractFile->offset = package->sdat + file->sdat_offset;
+    abstractFile->package = package;
+    abstractFile->spk_file = file;
     abstractFile->read = [=](void* data, off_t offset, size_t length) {
-      sdatRead(package, file, data, offset, length);
+      return sdatRead(package, file, data, offset, length);
     };
     char path[MAX_PATH];
     strsRead(package, file, path, 0, MAX_PATH);
@@ -370,9 +488,12 @@ Folder* splitSpkIntoFolders(const Spk* spk, FileReadCb rawRead, SpkReadCb strsRe
   Folder* root_folder = createFolder();
   root_folder->name = strdup("");
 
-  for(unsigned int i = 0; i < spk->package_count; i++) {
-    SpkPackage* package = &spk->packages[i];
-    Folder* package_folder = splitPackageIntoFolders(package, strsRead, sdatRead);
+  // Packages are independent, so their trees are built in parallel
+  std::vector<Folder*> package_folders(spk->package_count);
+  parallelFor(spk->package_count, [&](unsigned int i) {
+    package_folders[i] = splitPackageIntoFolders(&spk->packages[i], strsRead, sdatRead);
+  });
+  for(Folder* package_folder : package_folders) {
     addFolderToFolder(root_folder, package_folder);
   }
   
@@ -383,8 +504,11 @@ Folder* splitSpkIntoFolders(const Spk* spk, FileReadCb rawRead, SpkReadCb strsRe
     headerFile->name = strdup(headerFilename);
     headerFile->permissions = 0755;
     headerFile->size = spk->offset;
+    headerFile->offset = 0;
+    headerFile->package = NULL;
+    headerFile->spk_file = NULL;
     headerFile->read = [=](void* data, off_t offset, size_t length) {
-      rawRead(data, offset, length);
+      return rawRead(data, offset, length);
     };
     addFileToFolder(root_folder, headerFile);
   }
@@ -409,16 +533,7 @@ Folder* splitSpkIntoFolders(const Spk* spk, FileReadCb rawRead, SpkReadCb strsRe
     if (shortnameLength > 0) {
       content += "      \"shortname\": \"" + std::string(package->shortname, shortnameLength) + "\",\n";
     }
-    std::string type;
-    switch(package->type) {
-      case 1: type = "SPIKE_1"; break;
-      case 2: type = "GAME"; break;
-      case 3: type = "SPIKE_2"; break;
-      case 4: type = "SPIKE_3"; break;
-      default:
-        type = "UNKNOWN_" + std::to_string(package->type);
-    }
-    content += "      \"type\": \"" + type + "\",\n";
+    content += "      \"type\": \"" + spk_package_type_name(package) + "\",\n";
     content += "      \"version\": [" + std::to_string(package->version.major) + "," + std::to_string(package->version.minor) + "," + std::to_string(package->version.patch) + "],\n";
     content += "      \"files\": [\n";
     for(unsigned int i = 0; i < package->file_count; i++) {
@@ -443,8 +558,12 @@ Folder* splitSpkIntoFolders(const Spk* spk, FileReadCb rawRead, SpkReadCb strsRe
   metadataFile->name = strdup("metadata.json");
   metadataFile->permissions = 0755;
   metadataFile->size = content.length();
+  metadataFile->offset = -1;
+  metadataFile->package = NULL;
+  metadataFile->spk_file = NULL;
   metadataFile->read = [=](void* data, off_t offset, size_t length) {
     memcpy(data, &metadataFile->content.c_str()[offset], length);
+    return true;
   };
   addFileToFolder(root_folder, metadataFile);
 
@@ -474,21 +593,39 @@ void freeFolders(Folder* root_folder) {
 }
 
 
+bool spk_pread(int fd, void* data, size_t length, off_t offset) {
+  IoSlot slot;
+  uint8_t* p = (uint8_t*)data;
+  while(length > 0) {
+    ssize_t count = pread(fd, p, length, offset);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      return false;
+    }
+    p += count;
+    offset += count;
+    length -= count;
+  }
+  return true;
+}
+
 // Small helper as we are currently using FILE to load everything
 // In the future, there might be mmap support
+// We use pread on the underlying fd, so these callbacks can be used from multiple threads
 Folder* splitSpkIntoFoldersFromFILE(const Spk* spk, FILE* f) {
+  int fd = fileno(f);
   return splitSpkIntoFolders(spk,
     [=](void* data, off_t offset, size_t length) {
-      fseek(f, offset, SEEK_SET);
-      fread(data, 1, length, f);
+      return spk_pread(fd, data, length, offset);
     },
     [=](const SpkPackage* package, const SpkFile* file, void* data, off_t offset, size_t length) {
-      fseek(f, package->strs + file->strs_offset + offset, SEEK_SET);
-      fread(data, 1, length, f);
+      // Names are read with a fixed maximum length, so this may end early at the end of the archive
+      return spk_pread(fd, data, length, package->strs + file->strs_offset + offset);
     },
     [=](const SpkPackage* package, const SpkFile* file, void* data, off_t offset, size_t length) {
-      fseek(f, package->sdat + file->sdat_offset + offset, SEEK_SET);
-      fread(data, 1, length, f);
+      return spk_pread(fd, data, length, package->sdat + file->sdat_offset + offset);
     }
   );
-}
\ No newline at end of file
+}
@@ -1,10 +1,13 @@
 // Copyright (C) 2018 Jannik Vogel
 
+#pragma once
+
 #include <cstdio>
 #include <cstdlib>
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <string>
 
 #define MAX_PATH 2048
 
@@ -34,7 +37,8 @@ typedef struct SpkPackage_ {
   uint32_t unk3;
 
   // Custom data for easier parsing
-  off_t strs; //FIXME: Add size
+  off_t strs;
+  size_t strs_size;
   off_t sdat; //FIXME: Add size
   unsigned int file_count;
   struct SpkFile_* files;
@@ -52,14 +56,37 @@ typedef struct Spk_ {
 Spk* spk_parse(FILE* f);
 void spk_free(Spk* spk);
 
-using SpkReadCb = std::function<void(const SpkPackage* package, const SpkFile* file, void* data, off_t offset, size_t length)>;
-using FileReadCb = std::function<void(void* data, off_t offset, size_t length)>;
+// Receives a file record and its path from STRS (not terminated, only valid during the call).
+// Records of a package arrive in order from one thread, but packages are parsed in parallel.
+using SpkRecordCb = std::function<void(unsigned int package_index, const SpkFile* file, const char* path, size_t path_length)>;
+
+// Same as spk_parse, but file records are only handed to cb and never stored:
+// package->files stays NULL and package->file_count stays 0
+Spk* spk_parse_records(FILE* f, SpkRecordCb cb);
+
+// Reads the whole STRS of a package; paths are at file->strs_offset. Must be free()d.
+char* spk_read_strs(FILE* f, const SpkPackage* package);
+
+std::string spk_package_type_name(const SpkPackage* package);
+
+// Name of the folder the files of a package are in, like "game-1_02_0"
+std::string spk_package_foldername(const SpkPackage* package);
+
+// Lowercase hex, as used for checksums
+std::string spk_hex(const uint8_t* data, size_t length);
+
+// Read callbacks return false if not all of the data could be read
+using SpkReadCb = std::function<bool(const SpkPackage* package, const SpkFile* file, void* data, off_t offset, size_t length)>;
+using FileReadCb = std::function<bool(void* data, off_t offset, size_t length)>;
 
 struct File {
   char* name;
   uint16_t permissions;
   FileReadCb read;
   size_t size;
+  off_t offset; // Absolute offset of the data in the archive, or -1 if not backed by it
+  const SpkPackage* package; // Index entry of the file, or NULL if it's not part of a package
+  const SpkFile* spk_file;
   virtual ~File() = default;
 };
 
@@ -71,8 +98,15 @@ typedef struct Folder_ {
   File** files;
 } Folder;
 
+Folder* createFolder();
+void addFolderToFolder(Folder* parent, Folder* child);
+Folder* addFileInPath(Folder* folder, char* path, File* file);
+
 Folder* splitPackageIntoFolders(const SpkPackage* package, SpkReadCb strsRead, SpkReadCb sdatRead);
+// Packages are split in parallel, so strsRead may be called from multiple threads
 Folder* splitSpkIntoFolders(const Spk* spk, FileReadCb rawRead, SpkReadCb strsRead, SpkReadCb sdatRead);
 void freeFolders(Folder* root_folder);
 
+// Reads length bytes at offset, counted against the I/O limit of the pool; false if the data ends early
+bool spk_pread(int fd, void* data, size_t length, off_t offset);
 Folder* splitSpkIntoFoldersFromFILE(const Spk* spk, FILE* f);
\ No newline at end of file
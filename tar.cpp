@@ -0,0 +1,122 @@
+// Copyright (C) 2018 Jannik Vogel
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+
+#include "tar.h"
+
+typedef struct {
+  char name[100];
+  char mode[8];
+  char uid[8];
+  char gid[8];
+  char size[12];
+  char mtime[12];
+  char checksum[8];
+  char type;
+  char link[100];
+  char magic[6];
+  char version[2];
+  char uname[32];
+  char gname[32];
+  char devmajor[8];
+  char devminor[8];
+  char prefix[155];
+  char pad[12];
+} TarHeader;
+static_assert(sizeof(TarHeader) == TAR_BLOCK_SIZE, "Bad tar header size");
+
+// Largest size which fits into the 11 octal digits of ustar
+#define TAR_MAX_USTAR_SIZE 077777777777ULL
+
+bool tar_write_all(int fd, const void* data, size_t length) {
+  const uint8_t* p = (const uint8_t*)data;
+  while(length > 0) {
+    ssize_t written = write(fd, p, length);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    p += written;
+    length -= written;
+  }
+  return true;
+}
+
+static bool writeHeaderBlock(int fd, const std::string& path, char type, mode_t mode, uint64_t size, const std::string& link) {
+  TarHeader header;
+  memset(&header, 0, sizeof(header));
+
+  // Longer values are in the pax header, this is only for old readers
+  strncpy(header.name, path.c_str(), sizeof(header.name));
+  strncpy(header.link, link.c_str(), sizeof(header.link));
+  snprintf(header.mode, sizeof(header.mode), "%07o", (unsigned int)(mode & 07777));
+  snprintf(header.uid, sizeof(header.uid), "%07o", 0);
+  snprintf(header.gid, sizeof(header.gid), "%07o", 0);
+  snprintf(header.size, sizeof(header.size), "%011llo", (unsigned long long)((size > TAR_MAX_USTAR_SIZE) ? 0 : size));
+  snprintf(header.mtime, sizeof(header.mtime), "%011o", 0);
+  header.type = type;
+  memcpy(header.magic, "ustar", 6);
+  memcpy(header.version, "00", 2);
+
+  // The checksum is calculated with the checksum field set to spaces
+  memset(header.checksum, ' ', sizeof(header.checksum));
+  unsigned int checksum = 0;
+  const uint8_t* bytes = (const uint8_t*)&header;
+  for(size_t i = 0; i < sizeof(header); i++) {
+    checksum += bytes[i];
+  }
+  snprintf(header.checksum, sizeof(header.checksum), "%06o", checksum);
+
+  return tar_write_all(fd, &header, sizeof(header));
+}
+
+// Adds "<length> key=value\n", where length includes itself
+static void addPaxRecord(std::string& records, const char* key, const std::string& value) {
+  size_t length = strlen(key) + value.length() + 3;
+  size_t total = length + std::to_string(length).length();
+  if (std::to_string(total).length() != std::to_string(length).length()) {
+    total++;
+  }
+  records += std::to_string(total) + " " + key + "=" + value + "\n";
+}
+
+bool tar_write_header(int fd, const std::string& path, char type, mode_t mode, uint64_t size, const std::string& link) {
+  std::string records;
+  if (path.length() > sizeof(TarHeader::name)) {
+    addPaxRecord(records, "path", path);
+  }
+  if (link.length() > sizeof(TarHeader::link)) {
+    addPaxRecord(records, "linkpath", link);
+  }
+  if (size > TAR_MAX_USTAR_SIZE) {
+    addPaxRecord(records, "size", std::to_string(size));
+  }
+
+  if (!records.empty()) {
+    std::string pax_path = "PaxHeaders/" + path.substr(path.rfind('/', path.length() - 2) + 1);
+    if (!writeHeaderBlock(fd, pax_path, 'x', 0644, records.length(), "") ||
+        !tar_write_all(fd, records.data(), records.length()) ||
+        !tar_write_padding(fd, records.length())) {
+      return false;
+    }
+  }
+
+  return writeHeaderBlock(fd, path, type, mode, size, link);
+}
+
+bool tar_write_padding(int fd, uint64_t size) {
+  static const uint8_t zeros[TAR_BLOCK_SIZE] = { 0 };
+  size_t padding = (TAR_BLOCK_SIZE - (size % TAR_BLOCK_SIZE)) % TAR_BLOCK_SIZE;
+  return tar_write_all(fd, zeros, padding);
+}
+
+bool tar_write_end(int fd) {
+  static const uint8_t zeros[2 * TAR_BLOCK_SIZE] = { 0 };
+  return tar_write_all(fd, zeros, sizeof(zeros));
+}
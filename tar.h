@@ -0,0 +1,29 @@
+// Copyright (C) 2018 Jannik Vogel
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+#include <sys/types.h>
+
+// Writing POSIX (pax) tar streams; every write handles short writes to pipes
+
+#define TAR_BLOCK_SIZE 512
+
+#define TAR_REGULAR '0'
+#define TAR_HARDLINK '1'
+#define TAR_DIRECTORY '5'
+
+bool tar_write_all(int fd, const void* data, size_t length);
+
+// Writes the header of a member; a pax header is added in front if path or link
+// don't fit into the ustar fields or size needs more than 11 octal digits
+bool tar_write_header(int fd, const std::string& path, char type, mode_t mode, uint64_t size, const std::string& link = "");
+
+// Pads the data of a member of size bytes to a full block
+bool tar_write_padding(int fd, uint64_t size);
+
+// Writes the end-of-archive marker
+bool tar_write_end(int fd);
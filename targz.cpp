@@ -0,0 +1,412 @@
+// Copyright (C) 2018 Jannik Vogel
+
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include <zlib.h>
+
+#include "targz.h"
+
+// Based on the ideas of zran.c from the zlib examples
+
+#define WINSIZE 32768
+#define CHUNK 16384
+
+struct SeekPoint {
+  off_t out; // Offset in the uncompressed stream
+  off_t in; // Offset of the first full byte in the compressed stream
+  int bits; // Bits of the byte before that, which still belong to this block
+  uint8_t window[WINSIZE]; // Uncompressed data before this point
+};
+
+struct TarGzIndex {
+  size_t size;
+  FileReadCb rawRead;
+  std::vector<SeekPoint*> points;
+
+  // We keep the last position, so sequential reads don't restart from a seek point
+  bool cursor_valid;
+  z_stream strm;
+  off_t cursor_in;
+  off_t cursor_out;
+  uint8_t input[CHUNK];
+  uint8_t discard[WINSIZE];
+
+  ~TarGzIndex() {
+    for(SeekPoint* point : points) {
+      delete point;
+    }
+    if (cursor_valid) {
+      inflateEnd(&strm);
+    }
+  }
+};
+
+struct TarMember {
+  std::string path;
+  uint16_t mode;
+  off_t offset;
+  size_t size;
+};
+
+// Watches the uncompressed stream go by and picks up all headers
+struct TarParser {
+  off_t want = 0; // Where the data we are collecting starts
+  size_t want_size = 512;
+  bool in_header = true;
+  bool done = false;
+  char type = '\0'; // Type of the extension whose data we are collecting
+  off_t next_header = 0;
+  std::string collected;
+  std::string long_name;
+  std::vector<TarMember> members;
+
+  void feed(const uint8_t* data, size_t length, off_t position) {
+    while(!done && length > 0) {
+      off_t end = position + length;
+      if (want >= end) {
+        return;
+      }
+      off_t start = std::max(want + (off_t)collected.size(), position);
+      size_t count = std::min((off_t)(want_size - collected.size()), end - start);
+      collected.append((const char*)&data[start - position], count);
+      if (collected.size() < want_size) {
+        return;
+      }
+
+      if (in_header) {
+        parseHeader((const uint8_t*)collected.data());
+      } else {
+        parseExtension();
+      }
+      collected.clear();
+    }
+  }
+
+  void expectHeader(off_t offset) {
+    want = offset;
+    want_size = 512;
+    in_header = true;
+  }
+
+  static uint64_t parseNumber(const uint8_t* field, size_t length) {
+    // GNU base-256 for large values
+    if (field[0] & 0x80) {
+      uint64_t value = field[0] & 0x7F;
+      for(size_t i = 1; i < length; i++) {
+        value = (value << 8) | field[i];
+      }
+      return value;
+    }
+    uint64_t value = 0;
+    for(size_t i = 0; i < length && field[i] != '\0'; i++) {
+      if (field[i] >= '0' && field[i] <= '7') {
+        value = (value << 3) | (field[i] - '0');
+      }
+    }
+    return value;
+  }
+
+  // Members end up in output folders, so they must not point outside of them
+  static bool isSafePath(const std::string& path) {
+    size_t start = 0;
+    while(true) {
+      size_t end = path.find('/', start);
+      std::string component = path.substr(start, (end == std::string::npos) ? std::string::npos : end - start);
+      if (component.empty() || component == "." || component == "..") {
+        return false;
+      }
+      if (end == std::string::npos) {
+        return true;
+      }
+      start = end + 1;
+    }
+  }
+
+  void parseHeader(const uint8_t* header) {
+    static const uint8_t zeros[512] = { 0 };
+    if (memcmp(header, zeros, 512) == 0) {
+      done = true;
+      return;
+    }
+
+    uint64_t size = parseNumber(&header[124], 12);
+    off_t data = want + 512;
+    next_header = data + ((size + 511) & ~(uint64_t)511);
+    type = header[156];
+
+    // GNU long name / pax header: collect the data, it describes the next header
+    if (type == 'L' || type == 'x') {
+      if (size == 0) {
+        expectHeader(next_header);
+        return;
+      }
+      want = data;
+      want_size = size;
+      in_header = false;
+      return;
+    }
+
+    std::string path;
+    if (!long_name.empty()) {
+      path = long_name;
+      long_name.clear();
+    } else {
+      path = std::string((const char*)header, strnlen((const char*)header, 100));
+      if (memcmp(&header[257], "ustar", 5) == 0 && header[345] != '\0') {
+        path = std::string((const char*)&header[345], strnlen((const char*)&header[345], 155)) + "/" + path;
+      }
+    }
+
+    // We can only represent regular files
+    if (type == '0' || type == '\0' || type == '7') {
+      while(path.compare(0, 2, "./") == 0) {
+        path.erase(0, 2);
+      }
+      while(!path.empty() && path[0] == '/') {
+        path.erase(0, 1);
+      }
+      if (!isSafePath(path)) {
+        printf("Skipping unsafe path '%s' in tar.gz\n", path.c_str());
+      } else {
+        members.push_back({ path, (uint16_t)(parseNumber(&header[100], 8) & 07777), data, size });
+      }
+    }
+
+    expectHeader(next_header);
+  }
+
+  void parseExtension() {
+    if (type == 'L') {
+      long_name = std::string(collected.c_str());
+    } else {
+      // pax records look like "<length> <key>=<value>\n"
+      size_t cursor = 0;
+      while(cursor < collected.size()) {
+        size_t length = strtoul(&collected[cursor], NULL, 10);
+        if (length == 0 || cursor + length > collected.size()) {
+          break;
+        }
+        std::string record = collected.substr(cursor, length - 1);
+        size_t space = record.find(' ');
+        if (space != std::string::npos && record.compare(space + 1, 5, "path=") == 0) {
+          long_name = record.substr(space + 1 + 5);
+        }
+        cursor += length;
+      }
+    }
+    expectHeader(next_header);
+  }
+};
+
+static void addPoint(TarGzIndex* index, int bits, off_t in, off_t out, unsigned int left, const uint8_t* window) {
+  SeekPoint* point = new SeekPoint();
+  point->out = out;
+  point->in = in;
+  point->bits = bits;
+  if (left) {
+    memcpy(point->window, &window[WINSIZE - left], left);
+  }
+  if (left < WINSIZE) {
+    memcpy(&point->window[left], window, WINSIZE - left);
+  }
+  index->points.push_back(point);
+}
+
+static bool buildIndex(TarGzIndex* index, TarParser& parser) {
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  if (inflateInit2(&strm, 47) != Z_OK) {
+    return false;
+  }
+
+  uint8_t* input = (uint8_t*)malloc(CHUNK);
+  uint8_t* window = (uint8_t*)malloc(WINSIZE);
+
+  off_t position = 0;
+  off_t totin = 0;
+  off_t totout = 0;
+  off_t last = 0;
+  int ret = Z_OK;
+  strm.avail_out = 0;
+  do {
+    size_t length = std::min((size_t)CHUNK, index->size - position);
+    if (length == 0) {
+      ret = Z_DATA_ERROR;
+      break;
+    }
+    if (!index->rawRead(input, position, length)) {
+      ret = Z_DATA_ERROR;
+      break;
+    }
+    position += length;
+    strm.avail_in = length;
+    strm.next_in = input;
+
+    do {
+      if (strm.avail_out == 0) {
+        strm.avail_out = WINSIZE;
+        strm.next_out = window;
+      }
+
+      // Inflate until the end of a block, so we can add seek points there
+      uint8_t* produced = strm.next_out;
+      totin += strm.avail_in;
+      totout += strm.avail_out;
+      ret = inflate(&strm, Z_BLOCK);
+      totin -= strm.avail_in;
+      totout -= strm.avail_out;
+      size_t count = strm.next_out - produced;
+      parser.feed(produced, count, totout - count);
+
+      if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR) {
+        ret = Z_DATA_ERROR;
+        break;
+      }
+      if (ret == Z_STREAM_END) {
+        break;
+      }
+
+      bool endOfBlock = (strm.data_type & 128) && !(strm.data_type & 64);
+      if (endOfBlock && (totout == 0 || totout - last > TARGZ_SPAN)) {
+        addPoint(index, strm.data_type & 7, totin, totout, strm.avail_out, window);
+        last = totout;
+      }
+    } while(strm.avail_in != 0);
+  } while(ret != Z_STREAM_END && ret != Z_DATA_ERROR);
+
+  inflateEnd(&strm);
+  free(window);
+  free(input);
+  return (ret == Z_STREAM_END) && !index->points.empty();
+}
+
+static bool seekTarGz(TarGzIndex* index, off_t offset) {
+  auto it = std::upper_bound(index->points.begin(), index->points.end(), offset, [](off_t offset, const SeekPoint* point) {
+    return offset < point->out;
+  });
+  assert(it != index->points.begin());
+  SeekPoint* point = *(it - 1);
+
+  if (index->cursor_valid) {
+    inflateEnd(&index->strm);
+  }
+  memset(&index->strm, 0, sizeof(index->strm));
+  int ret = inflateInit2(&index->strm, -15);
+  assert(ret == Z_OK);
+
+  index->cursor_in = point->in - (point->bits ? 1 : 0);
+  index->cursor_out = point->out;
+  index->strm.avail_in = 0;
+  index->cursor_valid = true;
+  if (point->bits) {
+    uint8_t c;
+    if (!index->rawRead(&c, index->cursor_in++, 1)) {
+      return false;
+    }
+    inflatePrime(&index->strm, point->bits, c >> (8 - point->bits));
+  }
+  inflateSetDictionary(&index->strm, point->window, WINSIZE);
+  return true;
+}
+
+static size_t inflateTarGz(TarGzIndex* index, uint8_t* data, size_t length) {
+  z_stream* strm = &index->strm;
+  strm->next_out = data;
+  strm->avail_out = length;
+  while(strm->avail_out > 0) {
+    if (strm->avail_in == 0) {
+      size_t count = std::min((off_t)CHUNK, (off_t)index->size - index->cursor_in);
+      if (count == 0) {
+        break;
+      }
+      if (!index->rawRead(index->input, index->cursor_in, count)) {
+        break;
+      }
+      index->cursor_in += count;
+      strm->next_in = index->input;
+      strm->avail_in = count;
+    }
+    if (inflate(strm, Z_NO_FLUSH) != Z_OK) {
+      break;
+    }
+  }
+  size_t produced = length - strm->avail_out;
+  index->cursor_out += produced;
+  return produced;
+}
+
+static bool readTarGz(TarGzIndex* index, uint8_t* data, off_t offset, size_t length) {
+  bool seeked = true;
+  if (!index->cursor_valid || offset < index->cursor_out || offset - index->cursor_out > TARGZ_SPAN) {
+    seeked = seekTarGz(index, offset);
+  }
+
+  while(seeked && index->cursor_out < offset) {
+    size_t skip = std::min((off_t)WINSIZE, offset - index->cursor_out);
+    if (inflateTarGz(index, index->discard, skip) != skip) {
+      break;
+    }
+  }
+
+  size_t produced = (seeked && index->cursor_out == offset) ? inflateTarGz(index, data, length) : 0;
+  if (produced < length) {
+    printf("Unable to inflate tar.gz at %lld\n", (long long)(offset + produced));
+    memset(&data[produced], 0x00, length - produced);
+    inflateEnd(&index->strm);
+    index->cursor_valid = false;
+    return false;
+  }
+  return true;
+}
+
+Folder* splitTarGzIntoFolders(const char* name, size_t size, FileReadCb rawRead) {
+  std::shared_ptr<TarGzIndex> index = std::make_shared<TarGzIndex>();
+  index->size = size;
+  index->rawRead = rawRead;
+  index->cursor_valid = false;
+
+  TarParser parser;
+  if (!buildIndex(index.get(), parser)) {
+    printf("Unable to index '%s'\n", name);
+    return NULL;
+  }
+
+  Folder* folder = createFolder();
+  folder->name = strdup(name);
+
+  for(const TarMember& member : parser.members) {
+    File* file = new File();
+    file->name = NULL;
+    file->permissions = member.mode;
+    file->size = member.size;
+    file->offset = -1;
+    file->package = NULL;
+    file->spk_file = NULL;
+    off_t data = member.offset;
+    file->read = [=](void* buffer, off_t offset, size_t length) {
+      return readTarGz(index.get(), (uint8_t*)buffer, data + offset, length);
+    };
+    addFileInPath(folder, (char*)member.path.c_str(), file);
+  }
+
+  return folder;
+}
+
+Folder* splitHeaderIntoFoldersFromFILE(const Spk* spk, FILE* f) {
+  if (spk->offset == 0) {
+    return NULL;
+  }
+  int fd = fileno(f);
+  return splitTarGzIntoFolders("header", spk->offset, [=](void* data, off_t offset, size_t length) {
+    return spk_pread(fd, data, length, offset);
+  });
+}
@@ -0,0 +1,16 @@
+// Copyright (C) 2018 Jannik Vogel
+
+#pragma once
+
+#include "spk.h"
+
+// Distance between seek points in the uncompressed stream
+#define TARGZ_SPAN (1024 * 1024)
+
+// Inflates a tar.gz once to build seek points and list its members, which are
+// returned as a folder. Reading a member only inflates from the nearest seek point.
+// rawRead is used to read the compressed data (size bytes, starting at 0).
+Folder* splitTarGzIntoFolders(const char* name, size_t size, FileReadCb rawRead);
+
+// Same for the tar.gz header in front of an SPK (if any), as folder "header"
+Folder* splitHeaderIntoFoldersFromFILE(const Spk* spk, FILE* f);